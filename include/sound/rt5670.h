@@ -22,6 +22,15 @@ struct rt5670_platform_data {
 	/* 0 = GPIO8; 1 = IN3N; */
 	unsigned int dmic3_data_pin;
 	/* 0 = GPIO9; 1 = GPIO10; 2 = GPIO5*/
+
+	/* load DSP in background, muxes stay in bypass until done */
+	bool dsp_async;
+	/* hold the DSP muxes in bypass while switching mode live */
+	bool dsp_mode_bypass;
+	/* DSP tuning file, default rt567x_dsp.bin */
+	const char *dsp_fw_name;
+	/* park an idle DSP only after this long, 0 = always reload */
+	unsigned int dsp_holdoff_ms;
 };
 
 #endif
@@ -10,42 +10,144 @@
  */
 
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/i2c.h>
 #include <linux/platform_device.h>
 #include <linux/firmware.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/regmap.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/sort.h>
+#include <linux/bsearch.h>
+#include <linux/bitmap.h>
+#include <linux/crc32.h>
+#include <asm/unaligned.h>
 #include <sound/soc.h>
 #include <sound/soc-dapm.h>
 
 #include "rt5670.h"
 #include "rt5670-dsp.h"
 
-#define DSP_CLK_RATE RT5670_DSP_CLK_96K
+/* I2C payload of one codec register access: 8-bit index, 16-bit value */
+#define RT5670_DSP_REG_BYTES		3
 
-static const struct firmware *rt5670_dsp_fw;
+/* DSP ready polling */
+#define RT5670_DSP_FAST_POLLS		3
+#define RT5670_DSP_POLL_MIN_US		20
+#define RT5670_DSP_POLL_MAX_US		1000
+#define RT5670_DSP_TIMEOUT_US		20000
+
+#define RT5670_DSP_FW_NAME "rt567x_dsp.bin"
+/* how long unbind waits for a pending firmware request, in ms */
+#define RT5670_DSP_FW_WAIT_MS		2000
+
+/* failed DSP commands in a row before the command clock steps down */
+#define RT5670_DSP_CLK_MAX_FAULTS	3
+
+/* upper limit of the DSP retention hold-off, in ms */
+#define RT5670_DSP_HOLDOFF_MAX		10000
+
+static void rt5670_dsp_busy_account(struct rt5670_priv *rt5670,
+		unsigned int us)
+{
+	struct rt5670_dsp_busy_stats *st = &rt5670->dsp_busy;
+	unsigned int bucket = us ? fls(us) : 0;
+
+	if (bucket >= RT5670_DSP_BUSY_BUCKETS)
+		bucket = RT5670_DSP_BUSY_BUCKETS - 1;
+	st->hist[bucket]++;
+	if (us > st->max_us)
+		st->max_us = us;
+}
 
 /**
  * rt5670_dsp_done - Wait until DSP is ready.
  * @codec: SoC Audio Codec device.
  *
  * To check voice DSP status and confirm it's ready for next work.
+ * RT5670_DSP_CTRL1 is polled back to back a few times first, since most
+ * commands finish within one I2C round trip. After that the poll backs
+ * off with a growing sleep until RT5670_DSP_TIMEOUT_US has elapsed. The
+ * time the BUSY bit stayed set is recorded in the busy histogram.
  *
  * Returns 0 for success or negative error code.
  */
-static int rt5670_dsp_done(struct snd_soc_codec *codec)
+static int rt5670_dsp_done(struct snd_soc_codec *codec,
+		struct rt5670_dsp_io_stats *io)
 {
-	unsigned int count = 0, dsp_val;
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int count = 0, dsp_val, delay = RT5670_DSP_POLL_MIN_US;
+	ktime_t start, timeout;
 
+	io->polls++;
+	io->bytes += RT5670_DSP_REG_BYTES;
 	dsp_val = snd_soc_read(codec, RT5670_DSP_CTRL1);
+	if (!(dsp_val & RT5670_DSP_BUSY_MASK)) {
+		rt5670_dsp_busy_account(rt5670, 0);
+		rt5670->dsp_clk_faults = 0;
+		return 0;
+	}
+
+	start = ktime_get();
+	timeout = ktime_add_us(start, RT5670_DSP_TIMEOUT_US);
 	while (dsp_val & RT5670_DSP_BUSY_MASK) {
-		if (count > 10)
+		if (ktime_after(ktime_get(), timeout)) {
+			rt5670->dsp_busy.timeouts++;
 			return -EBUSY;
+		}
+		if (++count > RT5670_DSP_FAST_POLLS) {
+			usleep_range(delay, delay * 2);
+			delay = min_t(unsigned int, delay * 2,
+				RT5670_DSP_POLL_MAX_US);
+		}
+		io->polls++;
+		io->bytes += RT5670_DSP_REG_BYTES;
 		dsp_val = snd_soc_read(codec, RT5670_DSP_CTRL1);
-		count++;
 	}
+	rt5670_dsp_busy_account(rt5670,
+		max_t(s64, ktime_us_delta(ktime_get(), start), 1));
+	rt5670->dsp_clk_faults = 0;
 
 	return 0;
 }
 
+static const char * const rt5670_dsp_clk_names[] = {
+	"768k", "384k", "192k", "96k",
+};
+
+/**
+ * rt5670_dsp_clk_fault - Account a failed DSP command.
+ * @codec: SoC audio codec device.
+ *
+ * Counts the error against the current command clock. A single fault
+ * may come from bus contention or a powered down DSP, so only after
+ * RT5670_DSP_CLK_MAX_FAULTS failed commands in a row the clock steps
+ * down to the next slower one; 96k is the last resort. The next DSP
+ * reset goes back to the clock found by rt5670_dsp_probe_clk().
+ */
+static void rt5670_dsp_clk_fault(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int idx = rt5670->dsp_clk >> RT5670_DSP_CLK_SFT;
+
+	rt5670->dsp_clk_errs[idx]++;
+	if (++rt5670->dsp_clk_faults < RT5670_DSP_CLK_MAX_FAULTS ||
+	    rt5670->dsp_clk == RT5670_DSP_CLK_96K)
+		return;
+
+	rt5670->dsp_clk_faults = 0;
+	rt5670->dsp_clk += 1 << RT5670_DSP_CLK_SFT;
+	dev_warn(codec->dev, "DSP command clock %s failed, using %s\n",
+		rt5670_dsp_clk_names[idx], rt5670_dsp_clk_names[idx + 1]);
+}
+
 /**
  * rt5670_dsp_write - Write DSP register.
  * @codec: SoC audio codec device.
@@ -55,318 +157,2475 @@ static int rt5670_dsp_done(struct snd_soc_codec *codec)
  * through DSP addr (0xe1), data (0xe2) and cmd (0xe0)
  * registers. It has to wait until the DSP is ready.
  *
+ * The addr and data registers are sent as one two-register burst,
+ * followed by the cmd write. The caller holds dsp_cmd_lock, see
+ * rt5670_dsp_begin(), so nothing can interleave with the sequence.
+ *
  * Returns 0 for success or negative error code.
  */
-int rt5670_dsp_write(struct snd_soc_codec *codec,
+static int __rt5670_dsp_write(struct snd_soc_codec *codec,
 		unsigned int addr, unsigned int data)
 {
-	unsigned int dsp_val;
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	u16 buf[2] = { addr, data };
 	int ret;
 
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL2, addr);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP addr reg: %d\n", ret);
-		goto err;
-	}
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL3, data);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP data reg: %d\n", ret);
-		goto err;
-	}
-	dsp_val = RT5670_DSP_I2C_AL_16 | RT5670_DSP_DL_2 |
-		RT5670_DSP_CMD_MW | DSP_CLK_RATE | RT5670_DSP_CMD_EN;
+	lockdep_assert_held(&rt5670->dsp_cmd_lock);
 
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL1, dsp_val);
+	rt5670->dsp_stats.writes.calls++;
+	/* register index and two values, then the cmd register */
+	rt5670->dsp_stats.writes.bytes += 1 + sizeof(buf) +
+		RT5670_DSP_REG_BYTES;
+	ret = regmap_bulk_write(rt5670->regmap, RT5670_DSP_CTRL2, buf, 2);
+	if (ret == 0)
+		ret = regmap_write(rt5670->regmap, RT5670_DSP_CTRL1,
+			RT5670_DSP_I2C_AL_16 | RT5670_DSP_DL_2 |
+			RT5670_DSP_CMD_MW | rt5670->dsp_clk |
+			RT5670_DSP_CMD_EN);
 	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP cmd reg: %d\n", ret);
+		dev_err(codec->dev, "Failed to write DSP cmd regs: %d\n", ret);
 		goto err;
 	}
-	ret = rt5670_dsp_done(codec);
+	ret = rt5670_dsp_done(codec, &rt5670->dsp_stats.writes);
 	if (ret < 0) {
 		dev_err(codec->dev, "DSP is busy: %d\n", ret);
+		rt5670_dsp_clk_fault(codec);
 		goto err;
 	}
 
 	return 0;
 
 err:
+	if (!rt5670->dsp_cmd_err)
+		rt5670->dsp_cmd_err = ret;
 	return ret;
 }
 
 /**
- * rt5670_dsp_read - Read DSP register.
+ * rt5670_dsp_begin - Start a batch of DSP commands.
  * @codec: SoC audio codec device.
- * @reg: DSP register index.
- *
- * Read DSP setting value from voice DSP. The DSP can be controlled
- * through DSP addr (0xe1), data (0xe2) and cmd (0xe0) registers. Each
- * command has to wait until the DSP is ready.
  *
- * Returns DSP register value or negative error code.
+ * Takes dsp_cmd_lock, so no other DSP command sequence can interleave
+ * its address, data or command writes with the batch. Nests inside
+ * dsp_mutex.
  */
-unsigned int rt5670_dsp_read(
-	struct snd_soc_codec *codec, unsigned int reg)
+void rt5670_dsp_begin(struct snd_soc_codec *codec)
 {
-	unsigned int value;
-	unsigned int dsp_val;
-	int ret = 0;
-
-	ret = rt5670_dsp_done(codec);
-	if (ret < 0) {
-		dev_err(codec->dev, "DSP is busy: %d\n", ret);
-		goto err;
-	}
-
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL2, reg);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP addr reg: %d\n", ret);
-		goto err;
-	}
-	dsp_val = RT5670_DSP_I2C_AL_16 | RT5670_DSP_DL_0 | RT5670_DSP_RW_MASK |
-		RT5670_DSP_CMD_MR | DSP_CLK_RATE | RT5670_DSP_CMD_EN;
-
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL1, dsp_val);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP cmd reg: %d\n", ret);
-		goto err;
-	}
-
-	ret = rt5670_dsp_done(codec);
-	if (ret < 0) {
-		dev_err(codec->dev, "DSP is busy: %d\n", ret);
-		goto err;
-	}
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
 
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL2, 0x26);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP addr reg: %d\n", ret);
-		goto err;
-	}
-	dsp_val = RT5670_DSP_DL_1 | RT5670_DSP_CMD_RR | RT5670_DSP_RW_MASK |
-		DSP_CLK_RATE | RT5670_DSP_CMD_EN;
+	mutex_lock(&rt5670->dsp_cmd_lock);
+	rt5670->dsp_cmd_err = 0;
+}
 
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL1, dsp_val);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP cmd reg: %d\n", ret);
-		goto err;
-	}
+/**
+ * rt5670_dsp_commit - End a batch of DSP commands.
+ * @codec: SoC audio codec device.
+ *
+ * Returns 0 if every DSP command of the batch completed, otherwise the
+ * error of the first failed one.
+ */
+int rt5670_dsp_commit(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	int ret = rt5670->dsp_cmd_err;
 
-	ret = rt5670_dsp_done(codec);
-	if (ret < 0) {
-		dev_err(codec->dev, "DSP is busy: %d\n", ret);
-		goto err;
-	}
+	mutex_unlock(&rt5670->dsp_cmd_lock);
 
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL2, 0x25);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP addr reg: %d\n", ret);
-		goto err;
-	}
+	return ret;
+}
 
-	dsp_val = RT5670_DSP_DL_1 | RT5670_DSP_CMD_RR | RT5670_DSP_RW_MASK |
-		DSP_CLK_RATE | RT5670_DSP_CMD_EN;
+static int rt5670_dsp_addr_cmp(const void *a, const void *b)
+{
+	return *(const u16 *)a - *(const u16 *)b;
+}
 
-	ret = snd_soc_write(codec, RT5670_DSP_CTRL1, dsp_val);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to write DSP cmd reg: %d\n", ret);
-		goto err;
-	}
+/**
+ * rt5670_dsp_slot - Look up the shadow slot of a DSP address.
+ * @rt5670: Private data.
+ * @addr: DSP address.
+ *
+ * Returns the slot index or -ENOENT if the address is not shadowed.
+ */
+static int rt5670_dsp_slot(struct rt5670_priv *rt5670, unsigned int addr)
+{
+	struct rt5670_dsp_fw *fw = rt5670->dsp_fw;
+	u16 key = addr;
+	u16 *p;
 
-	ret = rt5670_dsp_done(codec);
-	if (ret < 0) {
-		dev_err(codec->dev, "DSP is busy: %d\n", ret);
-		goto err;
-	}
+	if (!fw)
+		return -ENOENT;
 
-	ret = snd_soc_read(codec, RT5670_DSP_CTRL5);
-	if (ret < 0) {
-		dev_err(codec->dev, "Failed to read DSP data reg: %d\n", ret);
-		goto err;
-	}
+	p = bsearch(&key, fw->addrs, fw->num_addrs, sizeof(*fw->addrs),
+		rt5670_dsp_addr_cmp);
+	if (!p)
+		return -ENOENT;
 
-	value = ret;
-	return value;
+	return p - fw->addrs;
+}
 
-err:
-	return ret;
+static void rt5670_dsp_shadow_set(struct rt5670_priv *rt5670,
+		unsigned int slot, unsigned int data)
+{
+	rt5670->dsp_shadow[slot] = data;
+	set_bit(slot, rt5670->dsp_shadow_valid);
 }
 
-static int rt5670_dsp_mode_get(struct snd_kcontrol *kcontrol,
-		struct snd_ctl_elem_value *ucontrol)
+/**
+ * rt5670_dsp_shadow_invalidate - Forget the cached DSP memory contents.
+ * @codec: SoC audio codec device.
+ *
+ * Must be called whenever the DSP loses its state, e.g. on RST_DSP.
+ */
+void rt5670_dsp_shadow_invalidate(struct snd_soc_codec *codec)
 {
-	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
 	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
 
-	ucontrol->value.integer.value[0] = rt5670->dsp_sw;
-
-	return 0;
+	if (rt5670->dsp_shadow)
+		bitmap_zero(rt5670->dsp_shadow_valid, rt5670->dsp_fw->num_addrs);
 }
 
-static int rt5670_dsp_mode_put(struct snd_kcontrol *kcontrol,
-		struct snd_ctl_elem_value *ucontrol)
+/* rt5670_dsp_write() within a batch */
+static int rt5670_dsp_write_locked(struct snd_soc_codec *codec,
+		unsigned int addr, unsigned int data)
 {
-	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
 	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	int ret, slot;
 
-	if (rt5670->dsp_sw != ucontrol->value.integer.value[0])
-		rt5670->dsp_sw = ucontrol->value.integer.value[0];
+	ret = __rt5670_dsp_write(codec, addr, data);
+	slot = rt5670_dsp_slot(rt5670, addr);
+	if (slot >= 0 && rt5670->dsp_shadow) {
+		if (ret < 0)
+			clear_bit(slot, rt5670->dsp_shadow_valid);
+		else
+			rt5670_dsp_shadow_set(rt5670, slot, data);
+	}
 
-	return 0;
+	return ret;
 }
 
-/* DSP SRC Control */
-static const char * const rt5670_src_rxdp_mode[] = {
-	"Normal", "Divided by 2", "Divided by 3"
-};
-
-static const SOC_ENUM_SINGLE_DECL(
-	rt5670_src_rxdp_enum, RT5670_DSP_PATH1,
-	RT5670_RXDP_SRC_SFT, rt5670_src_rxdp_mode);
+int rt5670_dsp_write(struct snd_soc_codec *codec,
+		unsigned int addr, unsigned int data)
+{
+	rt5670_dsp_begin(codec);
+	rt5670_dsp_write_locked(codec, addr, data);
 
-static const char * const rt5670_src_txdp_mode[] = {
-	"Normal", "Multiplied by 2", "Multiplied by 3"
-};
+	return rt5670_dsp_commit(codec);
+}
 
-static const SOC_ENUM_SINGLE_DECL(
-	rt5670_src_txdp_enum, RT5670_DSP_PATH1,
-	RT5670_TXDP_SRC_SFT, rt5670_src_txdp_mode);
+/**
+ * rt5670_dsp_write_run - Write a run of DSP words, skipping cached ones.
+ * @codec: SoC audio codec device.
+ * @op: DSP op from a mode table.
+ * @val: Values of the op.
+ *
+ * Words whose shadow copy already holds the requested value are not
+ * sent to the DSP, but are still recorded in the DSP register cache so
+ * that a later cache sync restores the complete table. Must be called
+ * within a rt5670_dsp_begin() batch.
+ *
+ * Returns the number of words written or negative error code.
+ */
+int rt5670_dsp_write_run(struct snd_soc_codec *codec,
+		const struct rt5670_dsp_op *op, const u16 *val)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	bool shadow = rt5670->dsp_shadow != NULL;
+	unsigned int i, slot;
+	int ret, count = 0;
 
-/* DSP Mode */
-static const char * const rt5670_dsp_mode[] = {
-	"Mode 1", "Mode 2", "Mode 3", "Mode 4", "Mode 5"
-};
+	for (i = 0; i < op->len; i++) {
+		slot = op->slot + i;
+		if (shadow && test_bit(slot, rt5670->dsp_shadow_valid) &&
+		    rt5670->dsp_shadow[slot] == val[i]) {
+			/* the cache must still hold the whole table */
+			if (rt5670->dsp_regmap)
+				regmap_write(rt5670->dsp_regmap,
+					op->addr + i, val[i]);
+			continue;
+		}
 
-static const SOC_ENUM_SINGLE_DECL(rt5670_dsp_enum, 0, 0,
-	rt5670_dsp_mode);
+		ret = __rt5670_dsp_write(codec, op->addr + i, val[i]);
+		if (ret < 0) {
+			if (shadow)
+				clear_bit(slot, rt5670->dsp_shadow_valid);
+			return ret;
+		}
+		if (shadow)
+			rt5670_dsp_shadow_set(rt5670, slot, val[i]);
+		if (rt5670->dsp_regmap)
+			regmap_write(rt5670->dsp_regmap, op->addr + i, val[i]);
+		count++;
+	}
 
-static const struct snd_kcontrol_new rt5670_dsp_snd_controls[] = {
-	SOC_ENUM("RxDP SRC Switch", rt5670_src_rxdp_enum),
-	SOC_ENUM("TxDP SRC Switch", rt5670_src_txdp_enum),
-	SOC_ENUM_EXT("DSP Function Switch", rt5670_dsp_enum,
-		rt5670_dsp_mode_get, rt5670_dsp_mode_put),
-};
+	return count;
+}
 
 /**
- * rt5670_dsp_set_mode - Set DSP mode parameters.
- *
+ * rt5670_dsp_cmd - Issue one DSP command and wait for completion.
  * @codec: SoC audio codec device.
- * @mode: DSP mode.
- *
- * Set parameters of mode to DSP.
+ * @addr: Value for the DSP addr register (0xe1).
+ * @cmd: Value for the DSP cmd register (0xe0).
  *
  * Returns 0 for success or negative error code.
  */
-static int rt5670_dsp_set_mode(struct snd_soc_codec *codec, int mode)
+static int rt5670_dsp_cmd(struct snd_soc_codec *codec,
+		unsigned int addr, unsigned int cmd)
 {
-	int tab_num, n, ret = -EINVAL;
-	unsigned int pos = 0;
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct reg_default seq[] = {
+		{ RT5670_DSP_CTRL2, addr },
+		{ RT5670_DSP_CTRL1, cmd },
+	};
+	int ret;
 
-	if (rt5670_dsp_fw) {
-		n = rt5670_dsp_fw->data[0];
+	lockdep_assert_held(&rt5670->dsp_cmd_lock);
 
-		if (mode <= n) {
-			pos = rt5670_dsp_fw->data[mode * 3 + 2] |
-				rt5670_dsp_fw->data[mode * 3 + 1] << 8;
+	rt5670->dsp_stats.reads.bytes += ARRAY_SIZE(seq) *
+		RT5670_DSP_REG_BYTES;
+	ret = regmap_multi_reg_write(rt5670->regmap, seq, ARRAY_SIZE(seq));
+	if (ret < 0) {
+		dev_err(codec->dev, "Failed to write DSP cmd regs: %d\n", ret);
+		return ret;
+	}
 
-			tab_num = rt5670_dsp_fw->data[mode * 3 + 3];
-			if (pos + tab_num * 5 > rt5670_dsp_fw->size)
-				return -EINVAL;
-			ret = rt5670_write_fw(codec,
-				rt5670_dsp_fw, pos, tab_num);
-			if (ret < 0)
-				dev_err(codec->dev,
-					"Fail to set mode %d parameters: %d\n",
-					mode, ret);
-		}
+	ret = rt5670_dsp_done(codec, &rt5670->dsp_stats.reads);
+	if (ret < 0) {
+		dev_err(codec->dev, "DSP is busy: %d\n", ret);
+		rt5670_dsp_clk_fault(codec);
 	}
 
 	return ret;
 }
 
-static int rt5670_dsp_event(struct snd_soc_dapm_widget *w,
-			struct snd_kcontrol *k, int event)
+/**
+ * rt5670_dsp_read_word - Read one DSP word from an idle DSP.
+ * @codec: SoC audio codec device.
+ * @reg: DSP register index.
+ * @val: Returned value.
+ *
+ * Issues MR for @reg, then RR of the high and low data registers and
+ * fetches the result from RT5670_DSP_CTRL5. The DSP has to be idle on
+ * entry; it is idle again on successful return.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_read_word(struct snd_soc_codec *codec,
+		unsigned int reg, u16 *val)
 {
-	struct snd_soc_codec *codec = w->codec;
 	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	const unsigned int mr = RT5670_DSP_I2C_AL_16 | RT5670_DSP_DL_0 |
+		RT5670_DSP_RW_MASK | RT5670_DSP_CMD_MR | RT5670_DSP_CMD_EN;
+	const unsigned int rr = RT5670_DSP_DL_1 | RT5670_DSP_CMD_RR |
+		RT5670_DSP_RW_MASK | RT5670_DSP_CMD_EN;
+	unsigned int value;
+	int ret;
 
-	switch (event) {
-	case SND_SOC_DAPM_POST_PMD:
-		rt5670_dsp_write(codec, 0x22f9, 1);
-		break;
+	rt5670->dsp_stats.reads.calls++;
+	ret = rt5670_dsp_cmd(codec, reg, mr | rt5670->dsp_clk);
+	if (ret < 0)
+		return ret;
 
-	case SND_SOC_DAPM_POST_PMU:
-		snd_soc_update_bits(codec, RT5670_DIG_MISC,
-			RT5670_RST_DSP, RT5670_RST_DSP);
-		snd_soc_update_bits(codec, RT5670_DIG_MISC,
-			RT5670_RST_DSP, 0);
-		mdelay(10);
-		rt5670_dsp_set_mode(codec, rt5670->dsp_sw);
-		break;
+	ret = rt5670_dsp_cmd(codec, 0x26, rr | rt5670->dsp_clk);
+	if (ret < 0)
+		return ret;
 
-	default:
-		return 0;
+	ret = rt5670_dsp_cmd(codec, 0x25, rr | rt5670->dsp_clk);
+	if (ret < 0)
+		return ret;
+
+	rt5670->dsp_stats.reads.bytes += RT5670_DSP_REG_BYTES;
+	ret = regmap_read(rt5670->regmap, RT5670_DSP_CTRL5, &value);
+	if (ret < 0) {
+		dev_err(codec->dev, "Failed to read DSP data reg: %d\n", ret);
+		return ret;
 	}
+	*val = value;
 
 	return 0;
 }
 
-static const struct snd_soc_dapm_widget rt5670_dsp_dapm_widgets[] = {
-	SND_SOC_DAPM_SUPPLY_S("Voice DSP", 1, SND_SOC_NOPM,
-		0, 0, rt5670_dsp_event,
-		SND_SOC_DAPM_POST_PMD | SND_SOC_DAPM_POST_PMU),
-	SND_SOC_DAPM_PGA("DSP Downstream", SND_SOC_NOPM,
-		0, 0, NULL, 0),
-	SND_SOC_DAPM_PGA("DSP Upstream", SND_SOC_NOPM,
-		0, 0, NULL, 0),
-};
-
-static const struct snd_soc_dapm_route rt5670_dsp_dapm_routes[] = {
-	{"DSP Downstream", NULL, "Voice DSP"},
-	{"DSP Downstream", NULL, "RxDP Mux"},
-	{"DSP Upstream", NULL, "Voice DSP"},
-	{"DSP Upstream", NULL, "TDM Data Mux"},
-	{"DSP DL Mux", "DSP", "DSP Downstream"},
-	{"DSP UL Mux", "DSP", "DSP Upstream"},
-};
-
-static void rt5670_dsp_fw_loaded(const struct firmware *fw, void *context)
+/**
+ * rt5670_dsp_read - Read DSP register.
+ * @codec: SoC audio codec device.
+ * @reg: DSP register index.
+ *
+ * Read DSP setting value from voice DSP. The DSP can be controlled
+ * through DSP addr (0xe1), data (0xe2) and cmd (0xe0) registers. Each
+ * command has to wait until the DSP is ready.
+ *
+ * Returns DSP register value or negative error code.
+ */
+unsigned int rt5670_dsp_read(
+	struct snd_soc_codec *codec, unsigned int reg)
 {
-	if (fw) {
-		rt5670_dsp_fw = fw;
-		pr_debug("fw->size=%d\n", fw->size);
-	}
+	u16 value;
+	int ret;
+
+	ret = rt5670_dsp_read_bulk(codec, NULL, reg, 1, &value);
+	if (ret < 0)
+		return ret;
 
+	return value;
 }
 
 /**
- * rt5670_dsp_probe - register DSP for rt5670
- * @codec: audio codec
+ * rt5670_dsp_read_bulk - Read a list of DSP registers.
+ * @codec: SoC audio codec device.
+ * @regs: DSP register indexes, or NULL for a range starting at @start.
+ * @start: First DSP register index if @regs is NULL.
+ * @num: Number of registers to read.
+ * @vals: Returned values.
  *
- * To register DSP function for rt5670.
+ * Like rt5670_dsp_read() for many words: the whole list is read in one
+ * command batch, the DSP is checked for idle once up front and each
+ * word then only costs its own commands.
  *
  * Returns 0 for success or negative error code.
  */
-int rt5670_dsp_probe(struct snd_soc_codec *codec)
+int rt5670_dsp_read_bulk(struct snd_soc_codec *codec, const u16 *regs,
+		unsigned int start, unsigned int num, u16 *vals)
 {
-	if (codec == NULL)
-		return -EINVAL;
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int i;
+	int ret;
 
-	snd_soc_update_bits(codec, RT5670_PWR_DIG2,
-		RT5670_PWR_I2S_DSP, RT5670_PWR_I2S_DSP);
+	rt5670_dsp_begin(codec);
 
-	snd_soc_update_bits(codec, RT5670_DIG_MISC, RT5670_RST_DSP,
-		RT5670_RST_DSP);
-	snd_soc_update_bits(codec, RT5670_DIG_MISC, RT5670_RST_DSP, 0);
+	ret = rt5670_dsp_done(codec, &rt5670->dsp_stats.reads);
+	if (ret < 0) {
+		dev_err(codec->dev, "DSP is busy: %d\n", ret);
+		goto out;
+	}
 
-	mdelay(10);
+	for (i = 0; i < num; i++) {
+		ret = rt5670_dsp_read_word(codec,
+			regs ? regs[i] : start + i, &vals[i]);
+		if (ret < 0)
+			break;
+	}
+out:
+	rt5670_dsp_commit(codec);
 
-	rt5670_dsp_set_mode(codec, 0);
-	/* power down DSP */
-	mdelay(15);
+	return ret;
+}
+
+static int rt5670_dsp_reg_read(void *context, unsigned int reg,
+		unsigned int *val)
+{
+	struct snd_soc_codec *codec = context;
+	int ret;
+
+	ret = rt5670_dsp_read(codec, reg);
+	if (ret < 0)
+		return ret;
+	*val = ret;
+
+	return 0;
+}
+
+/* only called from regcache_sync(), within a command batch */
+static int rt5670_dsp_reg_write(void *context, unsigned int reg,
+		unsigned int val)
+{
+	return rt5670_dsp_write_locked(context, reg, val);
+}
+
+/* may run from regmap debugfs, outside dsp_mutex */
+static bool rt5670_dsp_readable_register(struct device *dev,
+		unsigned int reg)
+{
+	struct rt5670_priv *rt5670 = dev_get_drvdata(dev);
+	bool ret;
+
+	spin_lock(&rt5670->dsp_fw_lock);
+	ret = rt5670_dsp_slot(rt5670, reg) >= 0;
+	spin_unlock(&rt5670->dsp_fw_lock);
+
+	return ret;
+}
+
+/*
+ * DSP memory behind the MW/MR command interface. The map is kept in
+ * cache-only mode and records the tuning words written to the DSP; it
+ * is only synced to the hardware after the DSP lost its state.
+ */
+static const struct regmap_config rt5670_dsp_regmap = {
+	.name = "dsp",
+	.reg_bits = 16,
+	.val_bits = 16,
+	.max_register = 0xffff,
+	.readable_reg = rt5670_dsp_readable_register,
+	.reg_read = rt5670_dsp_reg_read,
+	.reg_write = rt5670_dsp_reg_write,
+	.cache_type = REGCACHE_RBTREE,
+};
+
+static unsigned int rt5670_dsp_rec_type(u8 type)
+{
+	switch (type) {
+	case 1:
+		return RT5670_DSP_OP_PR;
+	case 2:
+		return RT5670_DSP_OP_DSP;
+	default:
+		return RT5670_DSP_OP_REG;
+	}
+}
+
+static unsigned int rt5670_dsp_max_addr(unsigned int type)
+{
+	switch (type) {
+	case RT5670_DSP_OP_PR:
+		return RT5670_PR_MAX;
+	case RT5670_DSP_OP_DSP:
+		return 0xffff;
+	default:
+		return RT5670_VENDOR_ID2;
+	}
+}
+
+/**
+ * rt5670_dsp_tab_add - Append one record to a mode table.
+ * @tab: Mode table with room for the record.
+ * @type: RT5670_DSP_OP_* of the record.
+ * @addr: Register, PR or DSP address.
+ * @val: Value.
+ *
+ * Records are merged into runs of consecutive addresses so that the
+ * replay path does not have to look at the raw data again.
+ */
+static void rt5670_dsp_tab_add(struct rt5670_dsp_mode *tab,
+		unsigned int type, unsigned int addr, u16 val)
+{
+	struct rt5670_dsp_op *op = NULL;
+
+	if (tab->num_ops)
+		op = &tab->ops[tab->num_ops - 1];
+
+	if (op && op->type == type && op->addr + op->len == addr &&
+	    op->len < RT5670_DSP_BURST_MAX) {
+		op->len++;
+	} else {
+		op = &tab->ops[tab->num_ops++];
+		op->type = type;
+		op->addr = addr;
+		op->idx = tab->num_vals;
+		op->len = 1;
+	}
+	tab->vals[tab->num_vals++] = val;
+}
+
+static int rt5670_dsp_tab_alloc(struct rt5670_dsp_mode *tab,
+		unsigned int num)
+{
+	tab->ops = kcalloc(num, sizeof(*tab->ops), GFP_KERNEL);
+	tab->vals = kcalloc(num, sizeof(*tab->vals), GFP_KERNEL);
+	if (!tab->ops || !tab->vals)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/**
+ * rt5670_dsp_parse_mode - Decode one mode table of a v1 rt567x_dsp.bin.
+ * @dev: Device used for diagnostics.
+ * @fw: DSP firmware.
+ * @mode: DSP table.
+ * @tab: Mode table to fill.
+ *
+ * The blob starts with the index of the last table followed by a 3-byte
+ * header (16-bit offset, record count) per table. Each record is 5
+ * bytes: type, 16-bit address and 16-bit value.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_parse_mode(struct device *dev,
+		const struct firmware *fw, int mode, struct rt5670_dsp_mode *tab)
+{
+	unsigned int pos, tab_num, i, type, addr;
+	const u8 *rec;
+
+	if (mode * 3 + 3 >= fw->size)
+		return -EINVAL;
+
+	pos = fw->data[mode * 3 + 2] | fw->data[mode * 3 + 1] << 8;
+	tab_num = fw->data[mode * 3 + 3];
+	if (!tab_num || pos + tab_num * 5 > fw->size) {
+		dev_err(dev, "Invalid table for DSP mode %d\n", mode);
+		return -EINVAL;
+	}
+
+	if (rt5670_dsp_tab_alloc(tab, tab_num) < 0)
+		return -ENOMEM;
+
+	for (i = 0; i < tab_num; i++, pos += 5) {
+		rec = &fw->data[pos];
+		addr = (rec[1] << 8) | rec[2];
+		type = rt5670_dsp_rec_type(rec[0]);
+
+		if (addr > rt5670_dsp_max_addr(type)) {
+			dev_err(dev, "DSP mode %d: bad address %#x in record %d\n",
+				mode, addr, i);
+			return -EINVAL;
+		}
+
+		rt5670_dsp_tab_add(tab, type, addr, (rec[3] << 8) | rec[4]);
+	}
+
+	return 0;
+}
+
+/*
+ * rt567x_dsp.bin v2 container, all fields big-endian:
+ *
+ *   header      magic "RT67", version (2), table count, reserved (2),
+ *               file size (4), CRC-32 of everything after the header (4)
+ *   descriptor  per table: mode, rate (RT5670_DSP_RATE_*), flags (2),
+ *               section stream offset (4) and length (4)
+ *   section     type (as v1 records), encoding, first address (2),
+ *               word count (2), payload
+ *
+ * A section covers count consecutive addresses. Its payload is count
+ * raw words, one word repeated count times, or a first word followed by
+ * count - 1 signed 8-bit deltas.
+ */
+#define RT5670_DSP_FW_MAGIC		0x52543637
+#define RT5670_DSP_FW_V2		2
+#define RT5670_DSP_FW_HDR_LEN		16
+#define RT5670_DSP_FW_DESC_LEN		12
+#define RT5670_DSP_SEC_HDR_LEN		6
+
+enum {
+	RT5670_DSP_ENC_RAW,
+	RT5670_DSP_ENC_FILL,
+	RT5670_DSP_ENC_DELTA,
+};
+
+typedef int (*rt5670_dsp_emit_t)(void *ctx, unsigned int type,
+		unsigned int addr, const u16 *vals, unsigned int num);
+
+/**
+ * rt5670_dsp_decode - Decode a v2 section stream.
+ * @dev: Device used for diagnostics.
+ * @data: Section stream.
+ * @size: Length of the stream.
+ * @emit: Called for every run of up to RT5670_DSP_BURST_MAX words, in
+ *	stream order, or NULL to only validate the stream.
+ * @ctx: Passed to @emit.
+ *
+ * Sections are validated and expanded one at a time, so @emit sees the
+ * first words before the rest of the stream has been looked at. A
+ * malformed section stops the decoder, after the runs before it have
+ * been emitted.
+ *
+ * Returns the number of words decoded or negative error code.
+ */
+static int rt5670_dsp_decode(struct device *dev, const u8 *data, size_t size,
+		rt5670_dsp_emit_t emit, void *ctx)
+{
+	u16 buf[RT5670_DSP_BURST_MAX];
+	unsigned int type, enc, addr, count, len, i, n;
+	size_t pos = 0;
+	int ret, total = 0;
+	u16 val = 0;
+
+	while (pos < size) {
+		if (size - pos < RT5670_DSP_SEC_HDR_LEN)
+			goto bad;
+
+		type = rt5670_dsp_rec_type(data[pos]);
+		enc = data[pos + 1];
+		addr = get_unaligned_be16(&data[pos + 2]);
+		count = get_unaligned_be16(&data[pos + 4]);
+		pos += RT5670_DSP_SEC_HDR_LEN;
+
+		switch (enc) {
+		case RT5670_DSP_ENC_RAW:
+			len = count * 2;
+			break;
+		case RT5670_DSP_ENC_FILL:
+			len = 2;
+			break;
+		case RT5670_DSP_ENC_DELTA:
+			len = count + 1;
+			break;
+		default:
+			goto bad;
+		}
+
+		if (!count || len > size - pos ||
+		    addr + count - 1 > rt5670_dsp_max_addr(type))
+			goto bad;
+
+		for (i = 0, n = 0; i < count; i++) {
+			if (enc == RT5670_DSP_ENC_RAW)
+				val = get_unaligned_be16(&data[pos + i * 2]);
+			else if (i == 0)
+				val = get_unaligned_be16(&data[pos]);
+			else if (enc == RT5670_DSP_ENC_DELTA)
+				val += (s8)data[pos + i + 1];
+
+			buf[n++] = val;
+			if (n < RT5670_DSP_BURST_MAX && i + 1 < count)
+				continue;
+
+			if (emit) {
+				ret = emit(ctx, type, addr + i + 1 - n, buf, n);
+				if (ret < 0)
+					return ret;
+			}
+			n = 0;
+		}
+
+		pos += len;
+		total += count;
+	}
+
+	return total;
+
+bad:
+	dev_err(dev, "Bad DSP section at offset %zu\n", pos);
+	return -EINVAL;
+}
+
+static int rt5670_dsp_tab_emit(void *ctx, unsigned int type,
+		unsigned int addr, const u16 *vals, unsigned int num)
+{
+	struct rt5670_dsp_mode *tab = ctx;
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		rt5670_dsp_tab_add(tab, type, addr + i, vals[i]);
+
+	return 0;
+}
+
+/**
+ * rt5670_dsp_parse_v2 - Decode a v2 rt567x_dsp.bin.
+ * @dev: Device used for diagnostics.
+ * @fw: DSP firmware.
+ * @dsp_fw: Parsed firmware to fill.
+ *
+ * The whole file is checked against its CRC before any table is built,
+ * so a corrupted file is rejected as a whole.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_parse_v2(struct device *dev,
+		const struct firmware *fw, struct rt5670_dsp_fw *dsp_fw)
+{
+	const u8 *data = fw->data, *desc;
+	struct rt5670_dsp_mode *tab;
+	unsigned int num_tabs, i, idx, mode, rate;
+	size_t off, len, end;
+	u32 crc;
+	int ret;
+
+	if (fw->size < RT5670_DSP_FW_HDR_LEN)
+		return -EINVAL;
+
+	if (data[4] != RT5670_DSP_FW_V2) {
+		dev_err(dev, "Unsupported DSP firmware version %d\n", data[4]);
+		return -EINVAL;
+	}
+
+	num_tabs = data[5];
+	end = RT5670_DSP_FW_HDR_LEN + num_tabs * RT5670_DSP_FW_DESC_LEN;
+	if (get_unaligned_be32(&data[8]) != fw->size || end > fw->size) {
+		dev_err(dev, "Truncated DSP firmware\n");
+		return -EINVAL;
+	}
+
+	crc = crc32_le(~0, data + RT5670_DSP_FW_HDR_LEN,
+		fw->size - RT5670_DSP_FW_HDR_LEN) ^ ~0;
+	if (crc != get_unaligned_be32(&data[12])) {
+		dev_err(dev, "DSP firmware CRC mismatch: %08x\n", crc);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num_tabs; i++) {
+		desc = &data[RT5670_DSP_FW_HDR_LEN + i * RT5670_DSP_FW_DESC_LEN];
+		mode = desc[0];
+		rate = desc[1];
+		off = get_unaligned_be32(&desc[4]);
+		len = get_unaligned_be32(&desc[8]);
+
+		if (mode >= RT5670_DSP_MODE_NUM || rate >= RT5670_DSP_RATE_NUM ||
+		    off < end || off > fw->size || len > fw->size - off) {
+			dev_err(dev, "Invalid DSP table descriptor %d\n", i);
+			return -EINVAL;
+		}
+
+		idx = rate * RT5670_DSP_MODE_NUM + mode;
+		tab = &dsp_fw->modes[idx];
+		if (tab->ops) {
+			dev_err(dev, "Duplicate DSP table %d\n", idx);
+			return -EINVAL;
+		}
+
+		ret = rt5670_dsp_decode(dev, data + off, len, NULL, NULL);
+		if (ret <= 0)
+			return ret ? ret : -EINVAL;
+
+		/* rt5670_dsp_op.idx is 16 bits wide */
+		if (ret > U16_MAX) {
+			dev_err(dev, "DSP table %d too large: %d values\n",
+				idx, ret);
+			return -EINVAL;
+		}
+
+		ret = rt5670_dsp_tab_alloc(tab, ret);
+		if (ret < 0)
+			return ret;
+
+		ret = rt5670_dsp_decode(dev, data + off, len,
+			rt5670_dsp_tab_emit, tab);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * A tuning block may only touch DSP memory and the PR registers. Plain
+ * codec registers (power, reset, the DSP command interface, the PR
+ * index) are owned by DAPM and the driver.
+ */
+static int rt5670_dsp_tuning_check(void *ctx, unsigned int type,
+		unsigned int addr, const u16 *vals, unsigned int num)
+{
+	struct device *dev = ctx;
+
+	if (type == RT5670_DSP_OP_DSP || type == RT5670_DSP_OP_PR)
+		return 0;
+
+	dev_err(dev, "DSP tuning may not write codec register %#x\n", addr);
+
+	return -EINVAL;
+}
+
+static int rt5670_dsp_tuning_emit(void *ctx, unsigned int type,
+		unsigned int addr, const u16 *vals, unsigned int num)
+{
+	struct snd_soc_codec *codec = ctx;
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int i;
+	int slot, ret;
+
+	switch (type) {
+	case RT5670_DSP_OP_PR:
+		return rt5670_pr_write(rt5670->regmap, addr, vals, num);
+	case RT5670_DSP_OP_DSP:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num; i++) {
+		slot = rt5670_dsp_slot(rt5670, addr + i);
+		if (slot >= 0 && rt5670->dsp_shadow &&
+		    test_bit(slot, rt5670->dsp_shadow_valid) &&
+		    rt5670->dsp_shadow[slot] == vals[i])
+			continue;
+
+		ret = rt5670_dsp_write_locked(codec, addr + i, vals[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * rt5670_dsp_apply_tuning - Apply the tuning block on top of a mode.
+ * @codec: SoC audio codec device.
+ *
+ * Called with dsp_mutex held after a mode has been loaded, so that the
+ * uploaded tuning survives mode loads and stream restarts.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_apply_tuning(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	int ret;
+
+	if (!rt5670->dsp_tuning)
+		return 0;
+
+	rt5670_dsp_begin(codec);
+	ret = rt5670_dsp_decode(codec->dev, rt5670->dsp_tuning,
+		rt5670->dsp_tuning_len, rt5670_dsp_tuning_emit, codec);
+	rt5670_dsp_commit(codec);
+	if (ret < 0) {
+		dev_err(codec->dev, "Fail to apply DSP tuning: %d\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * "DSP Tuning Block": the TLV payload is a v2 section stream (see
+ * rt5670_dsp_decode()) of DSP and PR sections that is applied on top
+ * of the selected mode. Writing an empty block drops the tuning from
+ * the next mode load on. The soc_bytes_ext get/put handlers get no
+ * kcontrol, so the TLV callback is implemented here instead of using
+ * SND_SOC_BYTES_TLV.
+ */
+#define RT5670_DSP_TUNING_MAX		4096
+
+static int rt5670_dsp_tuning_tlv(struct snd_kcontrol *kcontrol, int op_flag,
+		unsigned int size, unsigned int __user *tlv)
+{
+	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int hdr[2];
+	u8 *buf = NULL;
+	int ret = 0;
+
+	switch (op_flag) {
+	case SNDRV_CTL_TLV_OP_READ:
+		mutex_lock(&rt5670->dsp_mutex);
+		hdr[0] = 0;
+		hdr[1] = rt5670->dsp_tuning_len;
+		if (size < sizeof(hdr) + hdr[1])
+			ret = -ENOSPC;
+		else if (copy_to_user(tlv, hdr, sizeof(hdr)) ||
+			 copy_to_user(tlv + 2, rt5670->dsp_tuning, hdr[1]))
+			ret = -EFAULT;
+		mutex_unlock(&rt5670->dsp_mutex);
+		return ret;
+
+	case SNDRV_CTL_TLV_OP_WRITE:
+		break;
+
+	default:
+		return -ENXIO;
+	}
+
+	if (size < sizeof(hdr))
+		return -EINVAL;
+
+	if (copy_from_user(hdr, tlv, sizeof(hdr)))
+		return -EFAULT;
+
+	if (hdr[1] > size - sizeof(hdr) || hdr[1] > RT5670_DSP_TUNING_MAX)
+		return -EINVAL;
+
+	if (hdr[1]) {
+		buf = memdup_user(tlv + 2, hdr[1]);
+		if (IS_ERR(buf))
+			return PTR_ERR(buf);
+
+		/* reject the block before any of it reaches the DSP */
+		ret = rt5670_dsp_decode(codec->dev, buf, hdr[1],
+			rt5670_dsp_tuning_check, codec->dev);
+		if (ret < 0) {
+			kfree(buf);
+			return ret;
+		}
+	}
+
+	mutex_lock(&rt5670->dsp_mutex);
+	kfree(rt5670->dsp_tuning);
+	rt5670->dsp_tuning = buf;
+	rt5670->dsp_tuning_len = hdr[1];
+	ret = 0;
+	if (rt5670->dsp_active && rt5670->dsp_cache_mode >= 0)
+		ret = rt5670_dsp_apply_tuning(codec);
+	mutex_unlock(&rt5670->dsp_mutex);
+
+	return ret;
+}
+
+static struct soc_bytes_ext rt5670_dsp_tuning_ext = {
+	.max = RT5670_DSP_TUNING_MAX,
+};
+
+static int rt5670_dsp_mode_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	ucontrol->value.enumerated.item[0] = rt5670->dsp_sw;
+
+	return 0;
+}
+
+static int rt5670_dsp_mode_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int mode = ucontrol->value.enumerated.item[0];
+
+	if (mode >= RT5670_DSP_MODE_NUM)
+		return -EINVAL;
+
+	if (rt5670->dsp_sw == mode)
+		return 0;
+
+	rt5670->dsp_sw = mode;
+
+	/* a running DSP switches right away, otherwise on POST_PMU */
+	if (rt5670->dsp_active)
+		schedule_work(&rt5670->dsp_mode_work);
+
+	return 1;
+}
+
+static int rt5670_dsp_holdoff_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	ucontrol->value.integer.value[0] = rt5670->dsp_holdoff_ms;
+
+	return 0;
+}
+
+static int rt5670_dsp_holdoff_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_kcontrol_codec(kcontrol);
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	long val = ucontrol->value.integer.value[0];
+
+	if (val < 0 || val > RT5670_DSP_HOLDOFF_MAX)
+		return -EINVAL;
+
+	if (rt5670->dsp_holdoff_ms == val)
+		return 0;
+
+	rt5670->dsp_holdoff_ms = val;
+
+	return 1;
+}
+
+/* DSP SRC Control */
+static const char * const rt5670_src_rxdp_mode[] = {
+	"Normal", "Divided by 2", "Divided by 3"
+};
+
+static const SOC_ENUM_SINGLE_DECL(
+	rt5670_src_rxdp_enum, RT5670_DSP_PATH1,
+	RT5670_RXDP_SRC_SFT, rt5670_src_rxdp_mode);
+
+static const char * const rt5670_src_txdp_mode[] = {
+	"Normal", "Multiplied by 2", "Multiplied by 3"
+};
+
+static const SOC_ENUM_SINGLE_DECL(
+	rt5670_src_txdp_enum, RT5670_DSP_PATH1,
+	RT5670_TXDP_SRC_SFT, rt5670_src_txdp_mode);
+
+/* DSP Mode */
+static const char * const rt5670_dsp_mode[] = {
+	"Mode 1", "Mode 2", "Mode 3", "Mode 4", "Mode 5"
+};
+
+static const SOC_ENUM_SINGLE_DECL(rt5670_dsp_enum, 0, 0,
+	rt5670_dsp_mode);
+
+static const struct snd_kcontrol_new rt5670_dsp_snd_controls[] = {
+	SOC_ENUM("RxDP SRC Switch", rt5670_src_rxdp_enum),
+	SOC_ENUM("TxDP SRC Switch", rt5670_src_txdp_enum),
+	SOC_ENUM_EXT("DSP Function Switch", rt5670_dsp_enum,
+		rt5670_dsp_mode_get, rt5670_dsp_mode_put),
+	SOC_SINGLE_EXT("DSP Retention Time", SND_SOC_NOPM, 0,
+		RT5670_DSP_HOLDOFF_MAX, 0,
+		rt5670_dsp_holdoff_get, rt5670_dsp_holdoff_put),
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "DSP Tuning Block",
+		.access = SNDRV_CTL_ELEM_ACCESS_TLV_READWRITE |
+			  SNDRV_CTL_ELEM_ACCESS_TLV_CALLBACK,
+		.tlv.c = rt5670_dsp_tuning_tlv,
+		.info = snd_soc_bytes_info_ext,
+		.private_value = (unsigned long)&rt5670_dsp_tuning_ext,
+	},
+};
+
+/**
+ * rt5670_dsp_table - Firmware table for the selected mode and rate.
+ * @rt5670: Private data of the codec.
+ *
+ * Falls back to the 48k table of the mode if the firmware has no
+ * variant for dsp_rate.
+ *
+ * Returns the index of the table in rt5670_dsp_fw.modes.
+ */
+static int rt5670_dsp_table(struct rt5670_priv *rt5670)
+{
+	int idx = rt5670->dsp_rate * RT5670_DSP_MODE_NUM + rt5670->dsp_sw;
+
+	if (!rt5670->dsp_fw || !rt5670->dsp_fw->modes[idx].num_ops)
+		return rt5670->dsp_sw;
+
+	return idx;
+}
+
+/**
+ * rt5670_dsp_set_mode - Set DSP mode parameters.
+ *
+ * @codec: SoC audio codec device.
+ * @idx: DSP table, see rt5670_dsp_table().
+ *
+ * Set parameters of mode to DSP.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_set_mode(struct snd_soc_codec *codec, int idx)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	const struct rt5670_dsp_mode *tab;
+	struct rt5670_dsp_load_stats *st;
+	int mode = idx % RT5670_DSP_MODE_NUM;
+	unsigned int us;
+	ktime_t start;
+	int ret;
+
+	if (idx < 0 || idx >= RT5670_DSP_TAB_NUM)
+		return -EINVAL;
+
+	if (!rt5670->dsp_fw)
+		return -EINVAL;
+
+	tab = &rt5670->dsp_fw->modes[idx];
+	if (!tab->num_ops)
+		return -EINVAL;
+
+	start = ktime_get();
+	ret = rt5670_write_fw(codec, tab);
+	if (ret < 0) {
+		dev_err(codec->dev, "Fail to set mode %d parameters: %d\n",
+			mode, ret);
+		return ret;
+	}
+
+	us = ktime_us_delta(ktime_get(), start);
+	dev_dbg(codec->dev, "DSP table %d: %d of %d records in %u us\n",
+		idx, ret, tab->num_vals, us);
+
+	st = &rt5670->dsp_stats.loads[mode];
+	if (!st->count || us < st->min_us)
+		st->min_us = us;
+	st->max_us = max(st->max_us, us);
+	st->total_us += us;
+	st->count++;
+
+	return 0;
+}
+
+/**
+ * rt5670_dsp_reset - Pulse RST_DSP.
+ * @codec: SoC audio codec device.
+ *
+ * The DSP memory is lost, so the shadow is invalidated and the DSP
+ * register cache is marked dirty. A command clock stepped down by
+ * faults goes back to the probed one. The caller must wait 10ms before
+ * issuing DSP commands.
+ */
+static void rt5670_dsp_reset(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	snd_soc_update_bits(codec, RT5670_DIG_MISC,
+		RT5670_RST_DSP, RT5670_RST_DSP);
+	snd_soc_update_bits(codec, RT5670_DIG_MISC, RT5670_RST_DSP, 0);
+	rt5670->dsp_clk = rt5670->dsp_clk_max;
+	rt5670->dsp_clk_faults = 0;
+	rt5670->dsp_retained = false;
+	rt5670_dsp_shadow_invalidate(codec);
+	if (rt5670->dsp_regmap)
+		regcache_mark_dirty(rt5670->dsp_regmap);
+}
+
+/*
+ * Replay the PR and codec register records of a table, in table order,
+ * after the codec lost them in suspend.
+ */
+static int rt5670_dsp_replay_regs(struct snd_soc_codec *codec,
+		const struct rt5670_dsp_mode *tab)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	const struct rt5670_dsp_op *op;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < tab->num_ops; i++) {
+		op = &tab->ops[i];
+		switch (op->type) {
+		case RT5670_DSP_OP_PR:
+			ret = rt5670_pr_write(rt5670->regmap, op->addr,
+				&tab->vals[op->idx], op->len);
+			break;
+		case RT5670_DSP_OP_REG:
+			ret = regmap_bulk_write(rt5670->regmap, op->addr,
+				&tab->vals[op->idx], op->len);
+			break;
+		default:
+			continue;
+		}
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * rt5670_dsp_load - Bring a freshly reset DSP to a mode.
+ * @codec: SoC audio codec device.
+ * @mode: DSP table, see rt5670_dsp_table().
+ *
+ * If the DSP register cache already holds this table, only the cached
+ * DSP words are synced; the PR and codec register records of the table
+ * survive a DSP reset and are only replayed if they were lost in
+ * suspend. Otherwise the cache is dropped and the full table is
+ * downloaded. The tuning block, if any, is applied on top.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_load(struct snd_soc_codec *codec, int mode)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	int ret;
+
+	if (rt5670->dsp_regmap && rt5670->dsp_cache_mode == mode) {
+		ret = 0;
+		if (rt5670->dsp_regs_lost)
+			ret = rt5670_dsp_replay_regs(codec,
+				&rt5670->dsp_fw->modes[mode]);
+		if (ret == 0) {
+			rt5670_dsp_begin(codec);
+			regcache_cache_only(rt5670->dsp_regmap, false);
+			ret = regcache_sync(rt5670->dsp_regmap);
+			regcache_cache_only(rt5670->dsp_regmap, true);
+			rt5670_dsp_commit(codec);
+		}
+		if (ret == 0) {
+			rt5670->dsp_regs_lost = false;
+			goto tuning;
+		}
+		dev_warn(codec->dev, "DSP cache sync failed: %d\n", ret);
+	}
+
+	rt5670->dsp_cache_mode = -1;
+	if (rt5670->dsp_regmap) {
+		regcache_drop_region(rt5670->dsp_regmap, 0, 0xffff);
+		regcache_mark_dirty(rt5670->dsp_regmap);
+	}
+
+	ret = rt5670_dsp_set_mode(codec, mode);
+	if (ret < 0)
+		return ret;
+
+	rt5670->dsp_cache_mode = mode;
+	rt5670->dsp_regs_lost = false;
+tuning:
+	rt5670_dsp_apply_tuning(codec);
+
+	return 0;
+}
+
+/**
+ * rt5670_dsp_can_switch - Check if a table can go over the applied one.
+ * @rt5670: Private data of the codec.
+ * @idx: DSP table, see rt5670_dsp_table().
+ *
+ * Writing a table over a running DSP only gives the state of a reset
+ * and full load if both tables cover the same DSP words; a word only
+ * the applied table sets would keep its stale value otherwise.
+ *
+ * Returns true if table @idx sets exactly the DSP words of the applied
+ * table.
+ */
+static bool rt5670_dsp_can_switch(struct rt5670_priv *rt5670, int idx)
+{
+	const struct rt5670_dsp_mode *tab[2];
+	const struct rt5670_dsp_op *op;
+	unsigned int n, i, j;
+	unsigned long *map;
+	bool same;
+
+	if (rt5670->dsp_cache_mode < 0 || !rt5670->dsp_fw)
+		return false;
+
+	tab[0] = &rt5670->dsp_fw->modes[rt5670->dsp_cache_mode];
+	tab[1] = &rt5670->dsp_fw->modes[idx];
+	n = max(rt5670->dsp_fw->num_addrs, 1U);
+	map = kcalloc(BITS_TO_LONGS(n) * 2, sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return false;
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < tab[i]->num_ops; j++) {
+			op = &tab[i]->ops[j];
+			if (op->type == RT5670_DSP_OP_DSP)
+				bitmap_set(map + i * BITS_TO_LONGS(n),
+					op->slot, op->len);
+		}
+	}
+	same = bitmap_equal(map, map + BITS_TO_LONGS(n), n);
+	kfree(map);
+
+	return same;
+}
+
+/**
+ * rt5670_dsp_park - Park the DSP at the end of a stream.
+ * @codec: SoC audio codec device.
+ *
+ * With a retention hold-off set, the DSP is left running with its
+ * loaded state and only parked once the hold-off expires, so that a
+ * stream starting again within the hold-off can skip the reset and
+ * reload. There is no documented un-park command, so a parked DSP is
+ * always reset and reloaded.
+ */
+static void rt5670_dsp_park(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	if (rt5670->dsp_holdoff_ms && rt5670->dsp_cache_mode >= 0) {
+		rt5670->dsp_retained = true;
+		schedule_delayed_work(&rt5670->dsp_park_work,
+			msecs_to_jiffies(rt5670->dsp_holdoff_ms));
+		return;
+	}
+
+	rt5670->dsp_retained = false;
+	rt5670_dsp_write(codec, 0x22f9, 1);
+}
+
+/**
+ * rt5670_dsp_park_work - Park a retained DSP once the hold-off expired.
+ * @work: dsp_park_work of rt5670_priv.
+ */
+static void rt5670_dsp_park_work(struct work_struct *work)
+{
+	struct rt5670_priv *rt5670 = container_of(to_delayed_work(work),
+		struct rt5670_priv, dsp_park_work);
+
+	mutex_lock(&rt5670->dsp_mutex);
+	if (!rt5670->dsp_active && rt5670->dsp_retained) {
+		rt5670->dsp_retained = false;
+		rt5670_dsp_write(rt5670->codec, 0x22f9, 1);
+	}
+	mutex_unlock(&rt5670->dsp_mutex);
+}
+
+/**
+ * rt5670_dsp_unpark - Take over a retained DSP.
+ * @codec: SoC audio codec device.
+ *
+ * The caller must have cancelled dsp_park_work. A retained DSP has not
+ * been parked yet and still holds its memory, so it keeps running. A
+ * different mode covering the same DSP words is applied on top of the
+ * retained state, which writes only the words that differ; any other
+ * mode needs a reset and load. The DSP register cache is rebuilt with
+ * the complete new table, words the DSP already held included, so a
+ * later reset restores all of it.
+ *
+ * Returns true if the DSP was taken over, false if it needs a full
+ * reset and load.
+ */
+static bool rt5670_dsp_unpark(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	if (!rt5670->dsp_retained)
+		return false;
+
+	rt5670->dsp_retained = false;
+
+	if (rt5670->dsp_cache_mode != rt5670_dsp_table(rt5670)) {
+		if (!rt5670_dsp_can_switch(rt5670, rt5670_dsp_table(rt5670)))
+			return false;
+		return rt5670_dsp_load(codec, rt5670_dsp_table(rt5670)) == 0;
+	}
+
+	/* a tuning block written during the hold-off is not applied yet */
+	rt5670_dsp_apply_tuning(codec);
+
+	return true;
+}
+
+/**
+ * rt5670_dsp_power_off - Note that the DSP lost its power.
+ * @codec: SoC audio codec device.
+ *
+ * Called whenever PWR_I2S_DSP is cleared. The DSP memory is gone then,
+ * so a retained state must not be taken over. Callers are serialised
+ * with the DSP events by DAPM.
+ */
+void rt5670_dsp_power_off(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	rt5670->dsp_retained = false;
+}
+
+#define RT5670_DSP_MUX_MASK (RT5670_DSP_UL_SEL | RT5670_DSP_DL_SEL)
+
+/*
+ * Force the DSP UL/DL muxes to bypass behind DAPM. The user setting is
+ * kept in dsp_mux_saved, rt5670_dsp_bypass_put() updates it while the
+ * muxes are held, and written back on release.
+ */
+static void rt5670_dsp_mux_hold(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	mutex_lock(&rt5670->dsp_mux_lock);
+	rt5670->dsp_mux_held = RT5670_DSP_MUX_MASK;
+	snd_soc_update_bits(codec, RT5670_DSP_PATH1, RT5670_DSP_MUX_MASK,
+		RT5670_DSP_MUX_MASK);
+	mutex_unlock(&rt5670->dsp_mux_lock);
+}
+
+static void rt5670_dsp_mux_release(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	mutex_lock(&rt5670->dsp_mux_lock);
+	rt5670->dsp_mux_held = 0;
+	snd_soc_update_bits(codec, RT5670_DSP_PATH1, RT5670_DSP_MUX_MASK,
+		rt5670->dsp_mux_saved);
+	mutex_unlock(&rt5670->dsp_mux_lock);
+}
+
+/**
+ * rt5670_dsp_load_work - Reset the DSP and download the selected mode.
+ * @work: dsp_load_work of rt5670_priv.
+ *
+ * Used in async mode. The DSP UL/DL muxes are held in bypass while the
+ * DSP is reset and loaded, and are switched back to their DAPM setting
+ * once the download is complete.
+ */
+static void rt5670_dsp_load_work(struct work_struct *work)
+{
+	struct rt5670_priv *rt5670 =
+		container_of(work, struct rt5670_priv, dsp_load_work);
+	struct snd_soc_codec *codec = rt5670->codec;
+
+	mutex_lock(&rt5670->dsp_mutex);
+
+	/* before the firmware arrives its callback does the load */
+	if (completion_done(&rt5670->dsp_fw_done)) {
+		rt5670_dsp_reset(codec);
+		msleep(10);
+		rt5670_dsp_load(codec, rt5670_dsp_table(rt5670));
+	}
+
+	rt5670_dsp_mux_release(codec);
+
+	mutex_unlock(&rt5670->dsp_mutex);
+}
+
+/**
+ * rt5670_dsp_mode_work - Switch a running DSP to the selected mode.
+ * @work: dsp_mode_work of rt5670_priv.
+ *
+ * If the new table covers the same DSP words as the current one, it is
+ * written on top of it and only the words that differ go out. With
+ * dsp_mode_bypass set the DSP UL/DL muxes are held in bypass during the
+ * download. Any other table needs a reset, so the muxes are always held
+ * in bypass while the DSP is reset and loaded.
+ */
+static void rt5670_dsp_mode_work(struct work_struct *work)
+{
+	struct rt5670_priv *rt5670 =
+		container_of(work, struct rt5670_priv, dsp_mode_work);
+	struct snd_soc_codec *codec = rt5670->codec;
+	bool hold, reset;
+	int idx;
+
+	mutex_lock(&rt5670->dsp_mutex);
+
+	idx = rt5670_dsp_table(rt5670);
+	if (!rt5670->dsp_active || rt5670->dsp_cache_mode < 0 ||
+	    rt5670->dsp_cache_mode == idx ||
+	    work_pending(&rt5670->dsp_load_work))
+		goto out;
+
+	reset = !rt5670_dsp_can_switch(rt5670, idx);
+	hold = reset || rt5670->pdata.dsp_mode_bypass;
+	if (hold)
+		rt5670_dsp_mux_hold(codec);
+
+	if (reset) {
+		rt5670_dsp_reset(codec);
+		msleep(10);
+	}
+	if (rt5670_dsp_load(codec, idx) < 0)
+		dev_err(codec->dev, "Fail to switch DSP to table %d\n", idx);
+
+	if (hold)
+		rt5670_dsp_mux_release(codec);
+out:
+	mutex_unlock(&rt5670->dsp_mutex);
+}
+
+static int rt5670_dsp_event(struct snd_soc_dapm_widget *w,
+			struct snd_kcontrol *k, int event)
+{
+	struct snd_soc_codec *codec = w->codec;
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	switch (event) {
+	case SND_SOC_DAPM_POST_PMD:
+		cancel_work_sync(&rt5670->dsp_mode_work);
+		/* a pending load still holds the muxes in bypass */
+		if (cancel_work_sync(&rt5670->dsp_load_work))
+			rt5670_dsp_mux_release(codec);
+		mutex_lock(&rt5670->dsp_mutex);
+		rt5670_dsp_park(codec);
+		rt5670->dsp_active = false;
+		mutex_unlock(&rt5670->dsp_mutex);
+		break;
+
+	case SND_SOC_DAPM_POST_PMU:
+		cancel_delayed_work_sync(&rt5670->dsp_park_work);
+		mutex_lock(&rt5670->dsp_mutex);
+		if (rt5670_dsp_unpark(codec)) {
+			rt5670->dsp_active = true;
+			mutex_unlock(&rt5670->dsp_mutex);
+			break;
+		}
+		mutex_unlock(&rt5670->dsp_mutex);
+
+		if (rt5670->pdata.dsp_async) {
+			rt5670_dsp_mux_hold(codec);
+			mutex_lock(&rt5670->dsp_mutex);
+			rt5670->dsp_active = true;
+			mutex_unlock(&rt5670->dsp_mutex);
+			schedule_work(&rt5670->dsp_load_work);
+			break;
+		}
+
+		mutex_lock(&rt5670->dsp_mutex);
+		rt5670->dsp_active = true;
+		/* before the firmware arrives its callback does the load */
+		if (completion_done(&rt5670->dsp_fw_done)) {
+			rt5670_dsp_reset(codec);
+			mdelay(10);
+			rt5670_dsp_load(codec, rt5670_dsp_table(rt5670));
+		}
+		mutex_unlock(&rt5670->dsp_mutex);
+		break;
+
+	default:
+		return 0;
+	}
+
+	return 0;
+}
+
+static const struct snd_soc_dapm_widget rt5670_dsp_dapm_widgets[] = {
+	SND_SOC_DAPM_SUPPLY_S("Voice DSP", 1, SND_SOC_NOPM,
+		0, 0, rt5670_dsp_event,
+		SND_SOC_DAPM_POST_PMD | SND_SOC_DAPM_POST_PMU),
+	SND_SOC_DAPM_PGA("DSP Downstream", SND_SOC_NOPM,
+		0, 0, NULL, 0),
+	SND_SOC_DAPM_PGA("DSP Upstream", SND_SOC_NOPM,
+		0, 0, NULL, 0),
+};
+
+static const struct snd_soc_dapm_route rt5670_dsp_dapm_routes[] = {
+	{"DSP Downstream", NULL, "Voice DSP"},
+	{"DSP Downstream", NULL, "RxDP Mux"},
+	{"DSP Upstream", NULL, "Voice DSP"},
+	{"DSP Upstream", NULL, "TDM Data Mux"},
+	{"DSP DL Mux", "DSP", "DSP Downstream"},
+	{"DSP UL Mux", "DSP", "DSP Upstream"},
+};
+
+static void rt5670_dsp_fw_free(struct rt5670_dsp_fw *fw)
+{
+	int i;
+
+	if (!fw)
+		return;
+
+	for (i = 0; i < RT5670_DSP_TAB_NUM; i++) {
+		kfree(fw->modes[i].ops);
+		kfree(fw->modes[i].vals);
+	}
+	kfree(fw->addrs);
+	kfree(fw);
+}
+
+/**
+ * rt5670_dsp_index_addrs - Index the DSP addresses used by all modes.
+ * @fw: Parsed DSP firmware.
+ *
+ * Collects the DSP addresses of every mode into a sorted table and
+ * assigns each DSP op its slot in that table. Addresses of one op are
+ * consecutive, so its slots are consecutive too.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_index_addrs(struct rt5670_dsp_fw *fw)
+{
+	struct rt5670_dsp_mode *tab;
+	struct rt5670_dsp_op *op;
+	unsigned int i, j, k, n = 0;
+	u16 *addrs, *p;
+
+	for (i = 0; i < RT5670_DSP_TAB_NUM; i++)
+		n += fw->modes[i].num_vals;
+
+	addrs = kcalloc(max(n, 1U), sizeof(*addrs), GFP_KERNEL);
+	if (!addrs)
+		return -ENOMEM;
+
+	n = 0;
+	for (i = 0; i < RT5670_DSP_TAB_NUM; i++) {
+		tab = &fw->modes[i];
+		for (j = 0; j < tab->num_ops; j++) {
+			op = &tab->ops[j];
+			if (op->type != RT5670_DSP_OP_DSP)
+				continue;
+			for (k = 0; k < op->len; k++)
+				addrs[n++] = op->addr + k;
+		}
+	}
+
+	sort(addrs, n, sizeof(*addrs), rt5670_dsp_addr_cmp, NULL);
+	for (i = 0, j = 0; i < n; i++)
+		if (!j || addrs[i] != addrs[j - 1])
+			addrs[j++] = addrs[i];
+	n = j;
+
+	for (i = 0; i < RT5670_DSP_TAB_NUM; i++) {
+		tab = &fw->modes[i];
+		for (j = 0; j < tab->num_ops; j++) {
+			op = &tab->ops[j];
+			if (op->type != RT5670_DSP_OP_DSP)
+				continue;
+			p = bsearch(&op->addr, addrs, n, sizeof(*addrs),
+				rt5670_dsp_addr_cmp);
+			op->slot = p - addrs;
+		}
+	}
+
+	fw->addrs = addrs;
+	fw->num_addrs = n;
+
+	return 0;
+}
+
+/**
+ * rt5670_dsp_parse_fw - Decode rt567x_dsp.bin.
+ * @dev: Device used for diagnostics.
+ * @fw: DSP firmware.
+ *
+ * Both container versions are accepted. A v1 file has no magic; its
+ * byte 0 holds the index of the last table. Tables 0-4 are the modes at
+ * 48k; tables 5-9 and 10-14, if present, are the same modes at 16k and
+ * 8k. Tables of a v1 file with a malformed or empty header are left
+ * empty, while any error in a v2 file rejects it.
+ *
+ * Returns the parsed firmware or NULL if the file is unusable.
+ */
+static struct rt5670_dsp_fw *rt5670_dsp_parse_fw(struct device *dev,
+		const struct firmware *fw)
+{
+	struct rt5670_dsp_fw *dsp_fw;
+	struct rt5670_dsp_mode *tab;
+	int i, n;
+
+	dsp_fw = kzalloc(sizeof(*dsp_fw), GFP_KERNEL);
+	if (!dsp_fw)
+		return NULL;
+
+	if (fw->size >= 4 &&
+	    get_unaligned_be32(fw->data) == RT5670_DSP_FW_MAGIC) {
+		if (rt5670_dsp_parse_v2(dev, fw, dsp_fw) < 0)
+			goto err;
+		goto index;
+	}
+
+	n = fw->size ? fw->data[0] : -1;
+	for (i = 0; i <= n && i < RT5670_DSP_TAB_NUM; i++) {
+		/* rate variants are optional */
+		if (i >= RT5670_DSP_MODE_NUM && i * 3 + 3 < fw->size &&
+		    !fw->data[i * 3 + 3])
+			continue;
+
+		tab = &dsp_fw->modes[i];
+		if (rt5670_dsp_parse_mode(dev, fw, i, tab) < 0) {
+			kfree(tab->ops);
+			kfree(tab->vals);
+			memset(tab, 0, sizeof(*tab));
+		}
+	}
+
+index:
+	if (rt5670_dsp_index_addrs(dsp_fw) < 0)
+		goto err;
+
+	return dsp_fw;
+
+err:
+	rt5670_dsp_fw_free(dsp_fw);
+	return NULL;
+}
+
+/**
+ * rt5670_dsp_install_fw - Make parsed firmware the active one.
+ * @codec: SoC audio codec device.
+ * @dsp_fw: Parsed DSP firmware, owned by the codec afterwards.
+ *
+ * The shadow cache is resized to the new address table. Words known
+ * from the old table are carried over, so replacing the firmware of a
+ * running DSP does not force a full download. If the shadow cannot be
+ * allocated every DSP word is always written.
+ */
+static void rt5670_dsp_install_fw(struct snd_soc_codec *codec,
+		struct rt5670_dsp_fw *dsp_fw)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct rt5670_dsp_fw *old;
+	unsigned int n = max(dsp_fw->num_addrs, 1U);
+	unsigned long *valid;
+	unsigned int i;
+	u16 *shadow;
+	int slot;
+
+	shadow = kcalloc(n, sizeof(*shadow), GFP_KERNEL);
+	valid = kcalloc(BITS_TO_LONGS(n), sizeof(unsigned long), GFP_KERNEL);
+	if (!shadow || !valid) {
+		dev_warn(codec->dev, "No DSP shadow cache, using full writes\n");
+		kfree(shadow);
+		kfree(valid);
+		shadow = NULL;
+		valid = NULL;
+	}
+
+	for (i = 0; shadow && rt5670->dsp_shadow && i < dsp_fw->num_addrs;
+	     i++) {
+		slot = rt5670_dsp_slot(rt5670, dsp_fw->addrs[i]);
+		if (slot >= 0 && test_bit(slot, rt5670->dsp_shadow_valid)) {
+			shadow[i] = rt5670->dsp_shadow[slot];
+			set_bit(i, valid);
+		}
+	}
+
+	kfree(rt5670->dsp_shadow);
+	kfree(rt5670->dsp_shadow_valid);
+	rt5670->dsp_shadow = shadow;
+	rt5670->dsp_shadow_valid = valid;
+
+	old = rt5670->dsp_fw;
+	spin_lock(&rt5670->dsp_fw_lock);
+	rt5670->dsp_fw = dsp_fw;
+	spin_unlock(&rt5670->dsp_fw_lock);
+	rt5670_dsp_fw_free(old);
+	rt5670->dsp_cache_mode = -1;
+}
+
+/**
+ * rt5670_dsp_probe_clk - Find the fastest stable DSP command clock.
+ * @codec: SoC audio codec device.
+ *
+ * A DSP word of the firmware is read at 96k first. Starting at the
+ * fastest clock, two test patterns are then written to it and read
+ * back. The first clock that passes is kept, 96k is the fallback. The
+ * DSP has to be out of reset and idle; the word gets its original value
+ * back afterwards.
+ */
+static void rt5670_dsp_probe_clk(struct snd_soc_codec *codec)
+{
+	static const u16 pattern[] = { 0x5aa5, 0xa55a };
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int clk, addr, i;
+	u16 orig, val;
+	int ret;
+
+	if (!rt5670->dsp_fw || !rt5670->dsp_fw->num_addrs)
+		return;
+
+	addr = rt5670->dsp_fw->addrs[0];
+	rt5670->dsp_clk = RT5670_DSP_CLK_96K;
+	if (rt5670_dsp_read_bulk(codec, NULL, addr, 1, &orig) < 0)
+		return;
+
+	for (clk = RT5670_DSP_CLK_768K; clk < RT5670_DSP_CLK_96K;
+	     clk += 1 << RT5670_DSP_CLK_SFT) {
+		rt5670->dsp_clk = clk;
+		for (i = 0; i < ARRAY_SIZE(pattern); i++) {
+			ret = rt5670_dsp_write(codec, addr, pattern[i]);
+			if (ret == 0)
+				ret = rt5670_dsp_read_bulk(codec, NULL, addr,
+					1, &val);
+			if (ret < 0)
+				break;
+			if (val != pattern[i]) {
+				rt5670_dsp_clk_fault(codec);
+				break;
+			}
+		}
+		if (i == ARRAY_SIZE(pattern))
+			break;
+
+		/* a failed command may leave the DSP busy */
+		rt5670_dsp_reset(codec);
+		msleep(10);
+	}
+
+	rt5670->dsp_clk = clk;
+	rt5670->dsp_clk_max = clk;
+	rt5670->dsp_clk_faults = 0;
+	rt5670->dsp_clk_probed = true;
+	/* if every clock failed, the last reset restored the word */
+	if (clk != RT5670_DSP_CLK_96K)
+		rt5670_dsp_write(codec, addr, orig);
+	dev_info(codec->dev, "DSP command clock %s\n",
+		rt5670_dsp_clk_names[clk >> RT5670_DSP_CLK_SFT]);
+}
+
+/**
+ * rt5670_dsp_stage - Stage the selected mode while the DSP is idle.
+ * @codec: SoC audio codec device.
+ *
+ * Downloads the selected mode once so that the PR and codec register
+ * records are in place and the DSP register cache holds its words; the
+ * first stream then only has to sync the cached DSP words after its
+ * reset. The DSP is parked afterwards.
+ */
+static void rt5670_dsp_stage(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int pwr;
+
+	pwr = snd_soc_read(codec, RT5670_PWR_DIG2) & RT5670_PWR_I2S_DSP;
+	snd_soc_update_bits(codec, RT5670_PWR_DIG2,
+		RT5670_PWR_I2S_DSP, RT5670_PWR_I2S_DSP);
+
+	rt5670_dsp_reset(codec);
+	msleep(10);
+
+	if (!rt5670->dsp_clk_probed)
+		rt5670_dsp_probe_clk(codec);
+
+	if (rt5670->dsp_fw) {
+		rt5670_dsp_load(codec, rt5670_dsp_table(rt5670));
+		msleep(15);
+	}
+
+	/* power down DSP */
 	rt5670_dsp_write(codec, 0x22f9, 1);
 
+	snd_soc_update_bits(codec, RT5670_PWR_DIG2, RT5670_PWR_I2S_DSP, pwr);
+}
+
+static void rt5670_dsp_fw_handle(struct snd_soc_codec *codec,
+		const struct firmware *fw)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct rt5670_dsp_fw *dsp_fw = NULL;
+
+	if (fw) {
+		dev_dbg(codec->dev, "%s: size=%zu\n", rt5670->dsp_fw_name,
+			fw->size);
+
+		dsp_fw = rt5670_dsp_parse_fw(codec->dev, fw);
+		release_firmware(fw);
+	} else {
+		dev_warn(codec->dev, "%s not loaded, DSP stays in bypass\n",
+			rt5670->dsp_fw_name);
+	}
+
+	mutex_lock(&rt5670->dsp_mutex);
+
+	if (dsp_fw)
+		rt5670_dsp_install_fw(codec, dsp_fw);
+
+	if (!rt5670->dsp_active) {
+		rt5670_dsp_stage(codec);
+	} else if (rt5670->dsp_fw) {
+		/* a stream came up before the firmware, load it now */
+		rt5670_dsp_reset(codec);
+		msleep(10);
+		rt5670_dsp_load(codec, rt5670_dsp_table(rt5670));
+	}
+
+	/* completed under the lock so DSP events see a consistent state */
+	complete(&rt5670->dsp_fw_done);
+	mutex_unlock(&rt5670->dsp_mutex);
+}
+
+/* serialises the firmware callback against detaching its request */
+static DEFINE_MUTEX(rt5670_dsp_fw_req_lock);
+
+static void rt5670_dsp_fw_loaded(const struct firmware *fw, void *context)
+{
+	struct rt5670_dsp_fw_req *req = context;
+
+	mutex_lock(&rt5670_dsp_fw_req_lock);
+	if (req->codec)
+		rt5670_dsp_fw_handle(req->codec, fw);
+	else
+		release_firmware(fw);
+	kfree(req);
+	mutex_unlock(&rt5670_dsp_fw_req_lock);
+}
+
+static const unsigned int rt5670_dsp_rates[RT5670_DSP_RATE_NUM] = {
+	48000, 16000, 8000,
+};
+
+/**
+ * rt5670_dsp_hw_params - Pick the DSP tables for a stream rate.
+ * @codec: SoC audio codec device.
+ * @rate: Stream sample rate.
+ *
+ * Prefers the variant of the selected mode at the stream rate, and sets
+ * the RxDP/TxDP SRC to Normal for it. Otherwise a variant at a half or
+ * a third of the stream rate is used through the SRC. If no variant
+ * fits, dsp_rate and the SRC switches are left as they are. While the
+ * DSP is idle the chosen tables are staged right away.
+ */
+void rt5670_dsp_hw_params(struct snd_soc_codec *codec, unsigned int rate)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	unsigned int i, div, idx;
+
+	mutex_lock(&rt5670->dsp_mutex);
+
+	/* keep the rate of a running DSP */
+	if (rt5670->dsp_active || !rt5670->dsp_fw)
+		goto out;
+
+	for (div = 1; div <= 3; div++) {
+		for (i = 0; i < RT5670_DSP_RATE_NUM; i++) {
+			idx = i * RT5670_DSP_MODE_NUM + rt5670->dsp_sw;
+			if (rt5670_dsp_rates[i] * div == rate &&
+			    rt5670->dsp_fw->modes[idx].num_ops)
+				goto found;
+		}
+	}
+	/* fall back to the 48k tables rather than those of the last stream */
+	dev_dbg(codec->dev, "No DSP tables for %uHz\n", rate);
+	i = RT5670_DSP_RATE_48K;
+	div = 1;
+
+found:
+	rt5670->dsp_rate = i;
+	snd_soc_update_bits(codec, RT5670_DSP_PATH1,
+		RT5670_RXDP_SRC_MASK | RT5670_TXDP_SRC_MASK,
+		(div - 1) << RT5670_RXDP_SRC_SFT |
+		(div - 1) << RT5670_TXDP_SRC_SFT);
+
+	if (completion_done(&rt5670->dsp_fw_done) &&
+	    rt5670->dsp_cache_mode != rt5670_dsp_table(rt5670))
+		rt5670_dsp_stage(codec);
+out:
+	mutex_unlock(&rt5670->dsp_mutex);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static bool rt5670_dsp_tab_same_layout(const struct rt5670_dsp_mode *a,
+		const struct rt5670_dsp_mode *b)
+{
+	unsigned int i;
+
+	if (a->num_ops != b->num_ops || a->num_vals != b->num_vals)
+		return false;
+
+	for (i = 0; i < a->num_ops; i++)
+		if (a->ops[i].type != b->ops[i].type ||
+		    a->ops[i].addr != b->ops[i].addr ||
+		    a->ops[i].len != b->ops[i].len)
+			return false;
+
+	return true;
+}
+
+/**
+ * rt5670_dsp_tab_diff - Collect the records of a table that changed.
+ * @old: Table currently applied.
+ * @new: Same table of the new firmware, with the layout of @old.
+ * @diff: Table to fill with the records of @new that differ.
+ *
+ * Records are compared by position, so the write order of the table is
+ * kept. The shadow slots of the DSP ops in @diff are left to the
+ * caller, which looks them up in the new address table.
+ *
+ * Returns the number of changed records or negative error code.
+ */
+static int rt5670_dsp_tab_diff(const struct rt5670_dsp_mode *old,
+		const struct rt5670_dsp_mode *new, struct rt5670_dsp_mode *diff)
+{
+	const struct rt5670_dsp_op *op;
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < new->num_vals; i++)
+		if (new->vals[i] != old->vals[i])
+			n++;
+
+	if (!n)
+		return 0;
+
+	if (rt5670_dsp_tab_alloc(diff, n) < 0)
+		return -ENOMEM;
+
+	for (i = 0; i < new->num_ops; i++) {
+		op = &new->ops[i];
+		for (j = op->idx; j < op->idx + op->len; j++)
+			if (new->vals[j] != old->vals[j])
+				rt5670_dsp_tab_add(diff, op->type,
+					op->addr + j - op->idx, new->vals[j]);
+	}
+
+	return n;
+}
+
+/*
+ * Record table @idx as applied and rebuild the DSP register cache from
+ * it, without bus traffic, after it was written on top of a live DSP.
+ */
+static void rt5670_dsp_cache_table(struct snd_soc_codec *codec, int idx)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	const struct rt5670_dsp_mode *tab = &rt5670->dsp_fw->modes[idx];
+	const struct rt5670_dsp_op *op;
+	unsigned int i, j;
+
+	if (rt5670->dsp_regmap) {
+		regcache_drop_region(rt5670->dsp_regmap, 0, 0xffff);
+		regcache_mark_dirty(rt5670->dsp_regmap);
+		for (i = 0; i < tab->num_ops; i++) {
+			op = &tab->ops[i];
+			if (op->type != RT5670_DSP_OP_DSP)
+				continue;
+			for (j = 0; j < op->len; j++)
+				regmap_write(rt5670->dsp_regmap, op->addr + j,
+					tab->vals[op->idx + j]);
+		}
+	}
+	rt5670->dsp_cache_mode = idx;
+}
+
+/**
+ * rt5670_dsp_reload - Fetch the DSP firmware again and apply it.
+ * @codec: SoC audio codec device.
+ *
+ * On a running DSP only the records that changed in the applied table
+ * are written, provided the table kept its layout; otherwise the DSP
+ * is reset and the whole new table is loaded with the DSP UL/DL muxes
+ * held in bypass. An idle DSP is staged with the new tables.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_reload(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct rt5670_dsp_mode diff = { NULL };
+	const struct firmware *fw;
+	struct rt5670_dsp_fw *dsp_fw;
+	int ret, idx, n = -1;
+	unsigned int i;
+
+	if (!completion_done(&rt5670->dsp_fw_done))
+		return -EBUSY;
+
+	ret = request_firmware(&fw, rt5670->dsp_fw_name, codec->dev);
+	if (ret < 0)
+		return ret;
+
+	dsp_fw = rt5670_dsp_parse_fw(codec->dev, fw);
+	release_firmware(fw);
+	if (!dsp_fw)
+		return -EINVAL;
+
+	mutex_lock(&rt5670->dsp_mutex);
+
+	idx = rt5670->dsp_cache_mode;
+	if (rt5670->dsp_active && idx >= 0 && rt5670->dsp_fw &&
+	    rt5670_dsp_tab_same_layout(&rt5670->dsp_fw->modes[idx],
+		&dsp_fw->modes[idx])) {
+		n = rt5670_dsp_tab_diff(&rt5670->dsp_fw->modes[idx],
+			&dsp_fw->modes[idx], &diff);
+		if (n < 0) {
+			rt5670_dsp_fw_free(dsp_fw);
+			ret = n;
+			goto out;
+		}
+	}
+
+	rt5670_dsp_install_fw(codec, dsp_fw);
+
+	if (!rt5670->dsp_active) {
+		rt5670_dsp_stage(codec);
+		goto out;
+	}
+
+	if (n >= 0 && idx == rt5670_dsp_table(rt5670)) {
+		for (i = 0; i < diff.num_ops; i++) {
+			ret = rt5670_dsp_slot(rt5670, diff.ops[i].addr);
+			diff.ops[i].slot = max(ret, 0);
+		}
+		ret = n ? rt5670_write_fw(codec, &diff) : 0;
+		dev_info(codec->dev, "DSP table %d: %d records changed\n",
+			idx, n);
+	} else {
+		/* words only the old table set would keep stale values */
+		idx = rt5670_dsp_table(rt5670);
+		rt5670_dsp_mux_hold(codec);
+		rt5670_dsp_reset(codec);
+		msleep(10);
+		ret = rt5670_dsp_set_mode(codec, idx);
+		rt5670_dsp_mux_release(codec);
+	}
+	if (ret < 0)
+		goto out;
+
+	rt5670_dsp_cache_table(codec, idx);
+	rt5670_dsp_apply_tuning(codec);
+	ret = 0;
+out:
+	mutex_unlock(&rt5670->dsp_mutex);
+	kfree(diff.ops);
+	kfree(diff.vals);
+
+	return ret;
+}
+
+struct rt5670_dsp_snapshot {
+	size_t size;
+	__be16 data[];
+};
+
+static int rt5670_dsp_busy_show(struct seq_file *m, void *unused)
+{
+	struct rt5670_priv *rt5670 = m->private;
+	struct rt5670_dsp_busy_stats *st = &rt5670->dsp_busy;
+	int i;
+
+	seq_printf(m, "%-14s %u\n", "0 us", st->hist[0]);
+	for (i = 1; i < RT5670_DSP_BUSY_BUCKETS - 1; i++)
+		seq_printf(m, "%5u-%-5u us %u\n", 1 << (i - 1),
+			(1 << i) - 1, st->hist[i]);
+	seq_printf(m, ">=%-8u us %u\n", 1 << (i - 1), st->hist[i]);
+	seq_printf(m, "max: %u us\n", st->max_us);
+	seq_printf(m, "timeouts: %u\n", st->timeouts);
+
+	return 0;
+}
+
+static int rt5670_dsp_busy_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rt5670_dsp_busy_show, inode->i_private);
+}
+
+static ssize_t rt5670_dsp_busy_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct rt5670_priv *rt5670 = m->private;
+
+	memset(&rt5670->dsp_busy, 0, sizeof(rt5670->dsp_busy));
+
+	return count;
+}
+
+static const struct file_operations rt5670_dsp_busy_fops = {
+	.owner = THIS_MODULE,
+	.open = rt5670_dsp_busy_open,
+	.read = seq_read,
+	.write = rt5670_dsp_busy_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int rt5670_dsp_clk_show(struct seq_file *m, void *unused)
+{
+	struct rt5670_priv *rt5670 = m->private;
+	int i;
+
+	seq_printf(m, "clock: %s\n",
+		rt5670_dsp_clk_names[rt5670->dsp_clk >> RT5670_DSP_CLK_SFT]);
+	for (i = 0; i < ARRAY_SIZE(rt5670_dsp_clk_names); i++)
+		seq_printf(m, "%s errors: %u\n", rt5670_dsp_clk_names[i],
+			rt5670->dsp_clk_errs[i]);
+
+	return 0;
+}
+
+static int rt5670_dsp_clk_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rt5670_dsp_clk_show, inode->i_private);
+}
+
+static ssize_t rt5670_dsp_reload_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct snd_soc_codec *codec = file->private_data;
+	int ret;
+
+	ret = rt5670_dsp_reload(codec);
+	if (ret < 0)
+		return ret;
+
+	return count;
+}
+
+static const struct file_operations rt5670_dsp_reload_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = rt5670_dsp_reload_write,
+	.llseek = default_llseek,
+};
+
+static const struct file_operations rt5670_dsp_clk_fops = {
+	.owner = THIS_MODULE,
+	.open = rt5670_dsp_clk_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void rt5670_dsp_io_show(struct seq_file *m, const char *name,
+		const struct rt5670_dsp_io_stats *io)
+{
+	seq_printf(m, "%s: %u words, %llu bytes, %u polls\n", name,
+		io->calls, (unsigned long long)io->bytes, io->polls);
+}
+
+static int rt5670_dsp_stats_show(struct seq_file *m, void *unused)
+{
+	struct rt5670_priv *rt5670 = m->private;
+	struct rt5670_dsp_stats *st = &rt5670->dsp_stats;
+	struct rt5670_dsp_load_stats *ld;
+	int i;
+
+	rt5670_dsp_io_show(m, "write", &st->writes);
+	rt5670_dsp_io_show(m, "read", &st->reads);
+
+	for (i = 0; i < RT5670_DSP_MODE_NUM; i++) {
+		ld = &st->loads[i];
+		if (!ld->count)
+			continue;
+		seq_printf(m, "mode %d: %u loads, min %u avg %llu max %u us\n",
+			i, ld->count, ld->min_us,
+			div_u64(ld->total_us, ld->count), ld->max_us);
+	}
+
+	return 0;
+}
+
+static int rt5670_dsp_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rt5670_dsp_stats_show, inode->i_private);
+}
+
+static ssize_t rt5670_dsp_stats_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct rt5670_priv *rt5670 = m->private;
+
+	memset(&rt5670->dsp_stats, 0, sizeof(rt5670->dsp_stats));
+
+	return count;
+}
+
+static const struct file_operations rt5670_dsp_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = rt5670_dsp_stats_open,
+	.read = seq_read,
+	.write = rt5670_dsp_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * rt5670_dsp_bench - Replay a DSP table and measure the throughput.
+ * @codec: SoC audio codec device.
+ * @idx: DSP table.
+ * @runs: Number of downloads.
+ *
+ * The shadow cache is emptied before every run so that each download
+ * writes the whole table. Only allowed while the DSP is idle; the
+ * selected mode is staged again afterwards.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_dsp_bench(struct snd_soc_codec *codec, int idx,
+		unsigned int runs)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct rt5670_dsp_bench *b = &rt5670->dsp_bench;
+	unsigned int pwr, i, words;
+	u64 bytes;
+	ktime_t start;
+	int ret = 0;
+
+	if (idx < 0 || idx >= RT5670_DSP_TAB_NUM || !runs)
+		return -EINVAL;
+
+	mutex_lock(&rt5670->dsp_mutex);
+
+	if (rt5670->dsp_active || !completion_done(&rt5670->dsp_fw_done)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	pwr = snd_soc_read(codec, RT5670_PWR_DIG2) & RT5670_PWR_I2S_DSP;
 	snd_soc_update_bits(codec, RT5670_PWR_DIG2,
-		RT5670_PWR_I2S_DSP, 0);
+		RT5670_PWR_I2S_DSP, RT5670_PWR_I2S_DSP);
+	rt5670_dsp_reset(codec);
+	msleep(10);
+
+	words = rt5670->dsp_stats.writes.calls;
+	bytes = rt5670->dsp_stats.writes.bytes;
+	start = ktime_get();
+	for (i = 0; i < runs && ret == 0; i++) {
+		rt5670_dsp_shadow_invalidate(codec);
+		ret = rt5670_dsp_set_mode(codec, idx);
+	}
+	b->total_us = ktime_us_delta(ktime_get(), start);
+	b->words = rt5670->dsp_stats.writes.calls - words;
+	b->bytes = rt5670->dsp_stats.writes.bytes - bytes;
+	b->table = idx;
+	b->runs = i;
+
+	/* the DSP cache recorded the benchmark table */
+	rt5670->dsp_cache_mode = -1;
+	snd_soc_update_bits(codec, RT5670_PWR_DIG2, RT5670_PWR_I2S_DSP, pwr);
+	rt5670_dsp_stage(codec);
+out:
+	mutex_unlock(&rt5670->dsp_mutex);
+
+	return ret;
+}
+
+static int rt5670_dsp_bench_show(struct seq_file *m, void *unused)
+{
+	struct rt5670_priv *rt5670 = m->private;
+	struct rt5670_dsp_bench *b = &rt5670->dsp_bench;
+	u64 us = max_t(u64, b->total_us, 1);
+
+	if (!b->runs)
+		return 0;
+
+	seq_printf(m, "table %u: %u runs in %llu us\n", b->table, b->runs,
+		(unsigned long long)b->total_us);
+	seq_printf(m, "%llu words/s, %llu bytes/s\n",
+		div64_u64((u64)b->words * USEC_PER_SEC, us),
+		div64_u64(b->bytes * USEC_PER_SEC, us));
+
+	return 0;
+}
+
+static int rt5670_dsp_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rt5670_dsp_bench_show, inode->i_private);
+}
+
+/* "<table> <runs>" starts a benchmark */
+static ssize_t rt5670_dsp_bench_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct rt5670_priv *rt5670 = m->private;
+	unsigned int runs;
+	char kbuf[32];
+	int idx, ret;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	if (sscanf(kbuf, "%d %u", &idx, &runs) != 2)
+		return -EINVAL;
+
+	ret = rt5670_dsp_bench(rt5670->codec, idx, runs);
+	if (ret < 0)
+		return ret;
+
+	return count;
+}
+
+static const struct file_operations rt5670_dsp_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = rt5670_dsp_bench_open,
+	.read = seq_read,
+	.write = rt5670_dsp_bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Binary dump of every DSP address used by the firmware, as big endian
+ * (address, value) pairs of 16 bits each.
+ */
+static int rt5670_dsp_snapshot_open(struct inode *inode, struct file *file)
+{
+	struct snd_soc_codec *codec = inode->i_private;
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct rt5670_dsp_snapshot *snap = NULL;
+	struct rt5670_dsp_fw *fw;
+	unsigned int i, num;
+	u16 *vals = NULL;
+	int ret;
+
+	/* a firmware reload frees the address table */
+	mutex_lock(&rt5670->dsp_mutex);
+	fw = rt5670->dsp_fw;
+	num = fw ? fw->num_addrs : 0;
+	if (!num) {
+		ret = -ENODEV;
+		goto err;
+	}
+
+	snap = vmalloc(sizeof(*snap) + num * sizeof(snap->data[0]) * 2);
+	vals = kcalloc(num, sizeof(*vals), GFP_KERNEL);
+	if (!snap || !vals) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ret = rt5670_dsp_read_bulk(codec, fw->addrs, 0, num, vals);
+	if (ret < 0)
+		goto err;
+
+	for (i = 0; i < num; i++) {
+		snap->data[i * 2] = cpu_to_be16(fw->addrs[i]);
+		snap->data[i * 2 + 1] = cpu_to_be16(vals[i]);
+	}
+	snap->size = num * sizeof(snap->data[0]) * 2;
+	mutex_unlock(&rt5670->dsp_mutex);
+	kfree(vals);
+	file->private_data = snap;
+
+	return 0;
+
+err:
+	mutex_unlock(&rt5670->dsp_mutex);
+	kfree(vals);
+	vfree(snap);
+	return ret;
+}
+
+static ssize_t rt5670_dsp_snapshot_read(struct file *file,
+		char __user *buf, size_t count, loff_t *ppos)
+{
+	struct rt5670_dsp_snapshot *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, snap->data,
+		snap->size);
+}
+
+static int rt5670_dsp_snapshot_release(struct inode *inode,
+		struct file *file)
+{
+	vfree(file->private_data);
+
+	return 0;
+}
+
+static const struct file_operations rt5670_dsp_snapshot_fops = {
+	.owner = THIS_MODULE,
+	.open = rt5670_dsp_snapshot_open,
+	.read = rt5670_dsp_snapshot_read,
+	.llseek = default_llseek,
+	.release = rt5670_dsp_snapshot_release,
+};
+
+static void rt5670_dsp_debugfs_init(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	rt5670->dsp_debugfs = debugfs_create_dir("dsp",
+		codec->component.debugfs_root);
+	if (IS_ERR_OR_NULL(rt5670->dsp_debugfs))
+		return;
+
+	debugfs_create_file("busy_histogram", 0644, rt5670->dsp_debugfs,
+		rt5670, &rt5670_dsp_busy_fops);
+	debugfs_create_file("snapshot", 0400, rt5670->dsp_debugfs,
+		codec, &rt5670_dsp_snapshot_fops);
+	debugfs_create_file("clock", 0444, rt5670->dsp_debugfs,
+		rt5670, &rt5670_dsp_clk_fops);
+	debugfs_create_file("reload", 0200, rt5670->dsp_debugfs,
+		codec, &rt5670_dsp_reload_fops);
+	debugfs_create_file("stats", 0644, rt5670->dsp_debugfs,
+		rt5670, &rt5670_dsp_stats_fops);
+	debugfs_create_file("bench", 0644, rt5670->dsp_debugfs,
+		rt5670, &rt5670_dsp_bench_fops);
+}
+
+static void rt5670_dsp_debugfs_exit(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	debugfs_remove_recursive(rt5670->dsp_debugfs);
+	rt5670->dsp_debugfs = NULL;
+}
+#else
+static inline void rt5670_dsp_debugfs_init(struct snd_soc_codec *codec)
+{
+}
+
+static inline void rt5670_dsp_debugfs_exit(struct snd_soc_codec *codec)
+{
+}
+#endif
+
+/**
+ * rt5670_dsp_probe - register DSP for rt5670
+ * @codec: audio codec
+ *
+ * To register DSP function for rt5670.
+ *
+ * Returns 0 for success or negative error code.
+ */
+int rt5670_dsp_probe(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670;
+	int ret;
+
+	if (codec == NULL)
+		return -EINVAL;
+
+	rt5670 = snd_soc_codec_get_drvdata(codec);
+	INIT_WORK(&rt5670->dsp_load_work, rt5670_dsp_load_work);
+	mutex_init(&rt5670->dsp_cmd_lock);
+	INIT_WORK(&rt5670->dsp_mode_work, rt5670_dsp_mode_work);
+	INIT_DELAYED_WORK(&rt5670->dsp_park_work, rt5670_dsp_park_work);
+	mutex_init(&rt5670->dsp_mutex);
+	mutex_init(&rt5670->dsp_mux_lock);
+	spin_lock_init(&rt5670->dsp_fw_lock);
+	rt5670->dsp_mux_saved = snd_soc_read(codec, RT5670_DSP_PATH1) &
+		RT5670_DSP_MUX_MASK;
+	init_completion(&rt5670->dsp_fw_done);
+	rt5670->dsp_cache_mode = -1;
+	rt5670->dsp_clk = RT5670_DSP_CLK_96K;
+	rt5670->dsp_clk_max = RT5670_DSP_CLK_96K;
+	rt5670->dsp_fw_name = rt5670->pdata.dsp_fw_name ?
+		rt5670->pdata.dsp_fw_name : RT5670_DSP_FW_NAME;
+	rt5670->dsp_holdoff_ms = min_t(unsigned int,
+		rt5670->pdata.dsp_holdoff_ms, RT5670_DSP_HOLDOFF_MAX);
+
+	rt5670->dsp_regmap = regmap_init(codec->dev, NULL, codec,
+					 &rt5670_dsp_regmap);
+	if (IS_ERR(rt5670->dsp_regmap)) {
+		dev_warn(codec->dev, "Failed to init DSP regmap: %ld\n",
+			 PTR_ERR(rt5670->dsp_regmap));
+		rt5670->dsp_regmap = NULL;
+	} else {
+		regcache_cache_only(rt5670->dsp_regmap, true);
+	}
 
 	snd_soc_add_codec_controls(codec, rt5670_dsp_snd_controls,
 			ARRAY_SIZE(rt5670_dsp_snd_controls));
@@ -375,9 +2634,105 @@ int rt5670_dsp_probe(struct snd_soc_codec *codec)
 	snd_soc_dapm_add_routes(&codec->dapm, rt5670_dsp_dapm_routes,
 			ARRAY_SIZE(rt5670_dsp_dapm_routes));
 
-	request_firmware_nowait(THIS_MODULE, FW_ACTION_HOTPLUG,
-				"rt567x_dsp.bin", codec->dev, GFP_KERNEL,
-				codec, rt5670_dsp_fw_loaded);
+	rt5670_dsp_debugfs_init(codec);
+
+	rt5670->dsp_fw_req = kzalloc(sizeof(*rt5670->dsp_fw_req), GFP_KERNEL);
+	if (!rt5670->dsp_fw_req) {
+		rt5670_dsp_fw_handle(codec, NULL);
+		return 0;
+	}
+
+	rt5670->dsp_fw_req->codec = codec;
+	ret = request_firmware_nowait(THIS_MODULE, FW_ACTION_HOTPLUG,
+				rt5670->dsp_fw_name, codec->dev, GFP_KERNEL,
+				rt5670->dsp_fw_req, rt5670_dsp_fw_loaded);
+	if (ret < 0) {
+		dev_err(codec->dev, "Failed to request %s: %d\n",
+			rt5670->dsp_fw_name, ret);
+		rt5670_dsp_fw_loaded(NULL, rt5670->dsp_fw_req);
+	}
 
 	return 0;
 }
+
+/**
+ * rt5670_dsp_remove - release DSP resources of rt5670
+ * @codec: audio codec
+ */
+void rt5670_dsp_remove(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	/*
+	 * The firmware loader may be waiting for its fallback; rather than
+	 * block the unbind for its whole timeout, detach the request so the
+	 * callback only drops the firmware.
+	 */
+	if (!wait_for_completion_timeout(&rt5670->dsp_fw_done,
+			msecs_to_jiffies(RT5670_DSP_FW_WAIT_MS))) {
+		mutex_lock(&rt5670_dsp_fw_req_lock);
+		if (!completion_done(&rt5670->dsp_fw_done))
+			rt5670->dsp_fw_req->codec = NULL;
+		mutex_unlock(&rt5670_dsp_fw_req_lock);
+	}
+	cancel_work_sync(&rt5670->dsp_mode_work);
+	cancel_work_sync(&rt5670->dsp_load_work);
+	cancel_delayed_work_sync(&rt5670->dsp_park_work);
+	rt5670_dsp_debugfs_exit(codec);
+
+	if (rt5670->dsp_regmap)
+		regmap_exit(rt5670->dsp_regmap);
+	rt5670->dsp_regmap = NULL;
+
+	kfree(rt5670->dsp_shadow);
+	kfree(rt5670->dsp_shadow_valid);
+	rt5670->dsp_shadow = NULL;
+	rt5670->dsp_shadow_valid = NULL;
+	rt5670_dsp_fw_free(rt5670->dsp_fw);
+	rt5670->dsp_fw = NULL;
+	kfree(rt5670->dsp_tuning);
+	rt5670->dsp_tuning = NULL;
+}
+
+#ifdef CONFIG_PM
+/**
+ * rt5670_dsp_suspend - prepare DSP state for codec suspend
+ * @codec: audio codec
+ *
+ * Most PR registers and the unnamed registers firmware tables write
+ * are not cached, so the next load after resume replays those records
+ * of the applied table before it syncs the cached DSP words.
+ */
+void rt5670_dsp_suspend(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	cancel_work_sync(&rt5670->dsp_mode_work);
+	cancel_work_sync(&rt5670->dsp_load_work);
+	cancel_delayed_work_sync(&rt5670->dsp_park_work);
+	rt5670->dsp_regs_lost = true;
+	rt5670->dsp_retained = false;
+	if (rt5670->dsp_regmap)
+		regcache_mark_dirty(rt5670->dsp_regmap);
+}
+
+/**
+ * rt5670_dsp_resume - restore DSP state after codec resume
+ * @codec: audio codec
+ *
+ * If the Voice DSP supply stayed on across suspend, DAPM will not run
+ * POST_PMU again, so the DSP is reloaded here.
+ */
+void rt5670_dsp_resume(struct snd_soc_codec *codec)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+
+	mutex_lock(&rt5670->dsp_mutex);
+	if (rt5670->dsp_active && completion_done(&rt5670->dsp_fw_done)) {
+		rt5670_dsp_reset(codec);
+		msleep(10);
+		rt5670_dsp_load(codec, rt5670_dsp_table(rt5670));
+	}
+	mutex_unlock(&rt5670->dsp_mutex);
+}
+#endif
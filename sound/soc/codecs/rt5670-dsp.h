@@ -43,11 +43,113 @@
 #define RT5670_DSP_I2C_AL_16		(0x1 << 1)
 #define RT5670_DSP_CMD_EN		(0x1)
 
+#define RT5670_DSP_MODE_NUM		5
+#define RT5670_DSP_BURST_MAX		32
+
+/* Firmware record types */
+enum {
+	RT5670_DSP_OP_REG,
+	RT5670_DSP_OP_PR,
+	RT5670_DSP_OP_DSP,
+};
+
+/* A run of consecutive addresses of one record type */
+struct rt5670_dsp_op {
+	u8 type;
+	u8 len;
+	u16 addr;
+	u16 idx; /* first value in rt5670_dsp_mode.vals */
+	u16 slot; /* first shadow slot, DSP ops only */
+};
+
+/* DSP BUSY time histogram, bucket n counts waits of [2^(n-1), 2^n) us */
+#define RT5670_DSP_BUSY_BUCKETS		16
+
+struct rt5670_dsp_busy_stats {
+	u32 hist[RT5670_DSP_BUSY_BUCKETS];
+	u32 max_us;
+	u32 timeouts;
+};
+
+/* DSP command interface accounting */
+struct rt5670_dsp_io_stats {
+	u32 calls; /* words written or read */
+	u32 polls; /* BUSY reads */
+	u64 bytes; /* register payload bytes on the bus */
+};
+
+struct rt5670_dsp_load_stats {
+	u32 count;
+	u32 min_us;
+	u32 max_us;
+	u64 total_us;
+};
+
+struct rt5670_dsp_stats {
+	struct rt5670_dsp_io_stats writes;
+	struct rt5670_dsp_io_stats reads;
+	struct rt5670_dsp_load_stats loads[RT5670_DSP_MODE_NUM];
+};
+
+/* last debugfs benchmark */
+struct rt5670_dsp_bench {
+	u32 table;
+	u32 runs;
+	u32 words;
+	u64 bytes;
+	u64 total_us;
+};
+
+struct rt5670_dsp_mode {
+	struct rt5670_dsp_op *ops;
+	u16 *vals;
+	unsigned int num_ops;
+	unsigned int num_vals;
+};
+
+/*
+ * DSP processing rates with their own tables. Table rate * MODE_NUM +
+ * mode of the firmware holds a mode at that rate; the 48k tables are
+ * the ones of older single-rate firmware.
+ */
+enum {
+	RT5670_DSP_RATE_48K,
+	RT5670_DSP_RATE_16K,
+	RT5670_DSP_RATE_8K,
+	RT5670_DSP_RATE_NUM,
+};
+
+#define RT5670_DSP_TAB_NUM	(RT5670_DSP_MODE_NUM * RT5670_DSP_RATE_NUM)
+
+/* Parsed DSP firmware of one codec */
+struct rt5670_dsp_fw {
+	struct rt5670_dsp_mode modes[RT5670_DSP_TAB_NUM];
+	u16 *addrs; /* sorted DSP addresses, index is the shadow slot */
+	unsigned int num_addrs;
+};
+
+/* Context of the pending firmware request, freed by its callback */
+struct rt5670_dsp_fw_req {
+	struct snd_soc_codec *codec; /* NULL once the codec is removed */
+};
+
 int rt5670_dsp_probe(struct snd_soc_codec *codec);
+void rt5670_dsp_remove(struct snd_soc_codec *codec);
+void rt5670_dsp_suspend(struct snd_soc_codec *codec);
+void rt5670_dsp_resume(struct snd_soc_codec *codec);
+void rt5670_dsp_hw_params(struct snd_soc_codec *codec, unsigned int rate);
+void rt5670_dsp_power_off(struct snd_soc_codec *codec);
+void rt5670_dsp_begin(struct snd_soc_codec *codec);
+int rt5670_dsp_commit(struct snd_soc_codec *codec);
 int rt5670_dsp_write(struct snd_soc_codec *codec,
 		unsigned int addr, unsigned int data);
 unsigned int rt5670_dsp_read(
 	struct snd_soc_codec *codec, unsigned int reg);
+int rt5670_dsp_read_bulk(struct snd_soc_codec *codec, const u16 *regs,
+		unsigned int start, unsigned int num, u16 *vals);
+int rt5670_dsp_write_run(struct snd_soc_codec *codec,
+		const struct rt5670_dsp_op *op, const u16 *val);
+void rt5670_dsp_shadow_invalidate(struct snd_soc_codec *codec);
 
 #endif /* __RT5670_DSP_H__ */
 
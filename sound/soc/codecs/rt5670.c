@@ -13,6 +13,7 @@
 #include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include <linux/pm.h>
 #include <linux/i2c.h>
 #include <linux/platform_device.h>
@@ -34,14 +35,9 @@
 
 #define RT5670_DEVICE_ID 0x6271
 
-#define RT5670_PR_RANGE_BASE (0xff + 1)
-#define RT5670_PR_SPACING 0x100
-
-#define RT5670_PR_BASE (RT5670_PR_RANGE_BASE + (0 * RT5670_PR_SPACING))
-
 static const struct regmap_range_cfg rt5670_ranges[] = {
 	{ .name = "PR", .range_min = RT5670_PR_BASE,
-	  .range_max = RT5670_PR_BASE + 0xf8,
+	  .range_max = RT5670_PR_BASE + RT5670_PR_MAX,
 	  .selector_reg = RT5670_PRIV_INDEX,
 	  .selector_mask = 0xff,
 	  .selector_shift = 0x0,
@@ -56,14 +52,13 @@ static struct reg_default init_list[] = {
 };
 #define RT5670_INIT_REG_LEN ARRAY_SIZE(init_list)
 
+/*
+ * The flat cache cannot tell an unknown value from zero, so every
+ * readable, non-volatile register needs its reset value here.
+ */
 static const struct reg_default rt5670_reg[] = {
-	{ 0x00, 0x0000 },
 	{ 0x02, 0x8888 },
 	{ 0x03, 0x8888 },
-	{ 0x0a, 0x0001 },
-	{ 0x0b, 0x0827 },
-	{ 0x0c, 0x0000 },
-	{ 0x0d, 0x0008 },
 	{ 0x0e, 0x0000 },
 	{ 0x0f, 0x0808 },
 	{ 0x19, 0xafaf },
@@ -86,13 +81,10 @@ static const struct reg_default rt5670_reg[] = {
 	{ 0x2f, 0x1002 },
 	{ 0x30, 0x0000 },
 	{ 0x31, 0x5f00 },
-	{ 0x32, 0x0000 },
 	{ 0x33, 0x0000 },
 	{ 0x34, 0x0000 },
-	{ 0x35, 0x0000 },
 	{ 0x36, 0x0000 },
 	{ 0x37, 0x0000 },
-	{ 0x38, 0x0000 },
 	{ 0x3b, 0x0000 },
 	{ 0x3c, 0x007f },
 	{ 0x3d, 0x0000 },
@@ -108,6 +100,7 @@ static const struct reg_default rt5670_reg[] = {
 	{ 0x64, 0x0000 },
 	{ 0x65, 0x0000 },
 	{ 0x66, 0x0000 },
+	{ 0x6a, 0x0000 },
 	{ 0x6f, 0x8000 },
 	{ 0x70, 0x8000 },
 	{ 0x71, 0x8000 },
@@ -127,8 +120,6 @@ static const struct reg_default rt5670_reg[] = {
 	{ 0x84, 0x0000 },
 	{ 0x85, 0x0000 },
 	{ 0x86, 0x0008 },
-	{ 0x87, 0x0000 },
-	{ 0x88, 0x0000 },
 	{ 0x89, 0x0000 },
 	{ 0x8a, 0x0000 },
 	{ 0x8b, 0x0000 },
@@ -139,8 +130,6 @@ static const struct reg_default rt5670_reg[] = {
 	{ 0x90, 0x0646 },
 	{ 0x91, 0x0c06 },
 	{ 0x93, 0x0000 },
-	{ 0x94, 0x0000 },
-	{ 0x95, 0x0000 },
 	{ 0x97, 0x0000 },
 	{ 0x98, 0x0000 },
 	{ 0x99, 0x0000 },
@@ -148,22 +137,14 @@ static const struct reg_default rt5670_reg[] = {
 	{ 0x9b, 0x010a },
 	{ 0x9c, 0x0aea },
 	{ 0x9d, 0x000c },
-	{ 0x9e, 0x0400 },
-	{ 0xae, 0x7000 },
 	{ 0xaf, 0x0000 },
-	{ 0xb0, 0x6000 },
 	{ 0xb1, 0x0000 },
 	{ 0xb2, 0x0000 },
 	{ 0xb3, 0x001f },
-	{ 0xb4, 0x2206 },
 	{ 0xb5, 0x1f00 },
 	{ 0xb6, 0x0000 },
 	{ 0xb7, 0x0000 },
 	{ 0xbb, 0x0000 },
-	{ 0xbc, 0x0000 },
-	{ 0xbd, 0x0000 },
-	{ 0xbe, 0x0000 },
-	{ 0xbf, 0x0000 },
 	{ 0xc0, 0x0000 },
 	{ 0xc1, 0x0000 },
 	{ 0xc2, 0x0000 },
@@ -177,7 +158,6 @@ static const struct reg_default rt5670_reg[] = {
 	{ 0xd6, 0x0400 },
 	{ 0xd9, 0x0809 },
 	{ 0xda, 0x0000 },
-	{ 0xdb, 0x0001 },
 	{ 0xdc, 0x0049 },
 	{ 0xdd, 0x0009 },
 	{ 0xe6, 0x8000 },
@@ -193,251 +173,339 @@ static const struct reg_default rt5670_reg[] = {
 	{ 0xfc, 0x0080 },
 };
 
-static bool rt5670_volatile_register(struct device *dev, unsigned int reg)
+#define RT5670_REG_R		(0x1 << 0)	/* readable */
+#define RT5670_REG_W		(0x1 << 1)	/* writeable */
+#define RT5670_REG_V		(0x1 << 2)	/* volatile */
+#define RT5670_REG_RV		(RT5670_REG_R | RT5670_REG_V)
+#define RT5670_REG_RW		(RT5670_REG_R | RT5670_REG_W)
+#define RT5670_REG_RWV		(RT5670_REG_RW | RT5670_REG_V)
+
+/*
+ * Access flags of the plain register map. Registers not listed are
+ * write only, DSP firmware tables may touch them. They have no known
+ * default, so they are volatile to keep the flat cache from writing
+ * them back on resume. The PR window is handled in rt5670_reg_access().
+ */
+static const u8 rt5670_reg_flags[RT5670_VENDOR_ID2 + 1] = {
+	[0 ... RT5670_VENDOR_ID2] = RT5670_REG_W | RT5670_REG_V,
+	[RT5670_RESET] = RT5670_REG_RWV,
+	[RT5670_HP_VOL] = RT5670_REG_RW,
+	[RT5670_LOUT1] = RT5670_REG_RW,
+	[RT5670_CJ_CTRL1] = RT5670_REG_RWV,
+	[RT5670_CJ_CTRL2] = RT5670_REG_RWV,
+	[RT5670_CJ_CTRL3] = RT5670_REG_RWV,
+	[RT5670_IN2] = RT5670_REG_RW,
+	[RT5670_INL1_INR1_VOL] = RT5670_REG_RW,
+	[RT5670_DAC1_DIG_VOL] = RT5670_REG_RW,
+	[RT5670_DAC2_DIG_VOL] = RT5670_REG_RW,
+	[RT5670_DAC_CTRL] = RT5670_REG_RW,
+	[RT5670_STO1_ADC_DIG_VOL] = RT5670_REG_RW,
+	[RT5670_MONO_ADC_DIG_VOL] = RT5670_REG_RW,
+	[RT5670_STO2_ADC_DIG_VOL] = RT5670_REG_RW,
+	[RT5670_ADC_BST_VOL1] = RT5670_REG_RW,
+	[RT5670_ADC_BST_VOL2] = RT5670_REG_RW,
+	[RT5670_STO2_ADC_MIXER] = RT5670_REG_RW,
+	[RT5670_STO1_ADC_MIXER] = RT5670_REG_RW,
+	[RT5670_MONO_ADC_MIXER] = RT5670_REG_RW,
+	[RT5670_AD_DA_MIXER] = RT5670_REG_RW,
+	[RT5670_STO_DAC_MIXER] = RT5670_REG_RW,
+	[RT5670_DD_MIXER] = RT5670_REG_RW,
+	[RT5670_DIG_MIXER] = RT5670_REG_RW,
+	[RT5670_DSP_PATH1] = RT5670_REG_RW,
+	[RT5670_DSP_PATH2] = RT5670_REG_RW,
+	[RT5670_DIG_INF1_DATA] = RT5670_REG_RW,
+	[RT5670_DIG_INF2_DATA] = RT5670_REG_RW,
+	[RT5670_PDM_OUT_CTRL] = RT5670_REG_RW,
+	[RT5670_PDM_DATA_CTRL1] = RT5670_REG_RWV,
+	[RT5670_PDM1_DATA_CTRL2] = RT5670_REG_RW,
+	[RT5670_PDM1_DATA_CTRL3] = RT5670_REG_RW,
+	[RT5670_PDM1_DATA_CTRL4] = RT5670_REG_RWV,
+	[RT5670_PDM2_DATA_CTRL2] = RT5670_REG_RW,
+	[RT5670_PDM2_DATA_CTRL3] = RT5670_REG_RW,
+	[RT5670_PDM2_DATA_CTRL4] = RT5670_REG_RWV,
+	[RT5670_REC_L1_MIXER] = RT5670_REG_RW,
+	[RT5670_REC_L2_MIXER] = RT5670_REG_RW,
+	[RT5670_REC_R1_MIXER] = RT5670_REG_RW,
+	[RT5670_REC_R2_MIXER] = RT5670_REG_RW,
+	[RT5670_HPO_MIXER] = RT5670_REG_RW,
+	[RT5670_MONO_MIXER] = RT5670_REG_RW,
+	[RT5670_OUT_L1_MIXER] = RT5670_REG_RW,
+	[RT5670_OUT_R1_MIXER] = RT5670_REG_RW,
+	[RT5670_LOUT_MIXER] = RT5670_REG_RW,
+	[RT5670_PWR_DIG1] = RT5670_REG_RW,
+	[RT5670_PWR_DIG2] = RT5670_REG_RW,
+	[RT5670_PWR_ANLG1] = RT5670_REG_RW,
+	[RT5670_PWR_ANLG2] = RT5670_REG_RW,
+	[RT5670_PWR_MIXER] = RT5670_REG_RW,
+	[RT5670_PWR_VOL] = RT5670_REG_RW,
+	[RT5670_PRIV_INDEX] = RT5670_REG_RW,
+	/* selector window of rt5670_ranges, never cached */
+	[RT5670_PRIV_DATA] = RT5670_REG_RWV,
+	[RT5670_PRIV_DATA + 1] = RT5670_REG_RWV,
+	[RT5670_I2S4_SDP] = RT5670_REG_RW,
+	[RT5670_I2S1_SDP] = RT5670_REG_RW,
+	[RT5670_I2S2_SDP] = RT5670_REG_RW,
+	[RT5670_I2S3_SDP] = RT5670_REG_RW,
+	[RT5670_ADDA_CLK1] = RT5670_REG_RW,
+	[RT5670_ADDA_CLK2] = RT5670_REG_RW,
+	[RT5670_DMIC_CTRL1] = RT5670_REG_RW,
+	[RT5670_DMIC_CTRL2] = RT5670_REG_RW,
+	[RT5670_TDM_CTRL_1] = RT5670_REG_RW,
+	[RT5670_TDM_CTRL_2] = RT5670_REG_RW,
+	[RT5670_TDM_CTRL_3] = RT5670_REG_RW,
+	[RT5670_DSP_CLK] = RT5670_REG_RW,
+	[RT5670_GLB_CLK] = RT5670_REG_RW,
+	[RT5670_PLL_CTRL1] = RT5670_REG_RW,
+	[RT5670_PLL_CTRL2] = RT5670_REG_RW,
+	[RT5670_ASRC_1] = RT5670_REG_RW,
+	[RT5670_ASRC_2] = RT5670_REG_RW,
+	[RT5670_ASRC_3] = RT5670_REG_RW,
+	[RT5670_ASRC_4] = RT5670_REG_RW,
+	[RT5670_ASRC_5] = RT5670_REG_RWV,
+	[RT5670_ASRC_7] = RT5670_REG_RW,
+	[RT5670_ASRC_8] = RT5670_REG_RW,
+	[RT5670_ASRC_9] = RT5670_REG_RW,
+	[RT5670_ASRC_10] = RT5670_REG_RW,
+	[RT5670_ASRC_11] = RT5670_REG_RW,
+	[RT5670_ASRC_12] = RT5670_REG_RW,
+	[RT5670_ASRC_13] = RT5670_REG_RW,
+	[RT5670_ASRC_14] = RT5670_REG_RW,
+	[RT5670_DEPOP_M1] = RT5670_REG_RW,
+	[RT5670_DEPOP_M2] = RT5670_REG_RW,
+	[RT5670_DEPOP_M3] = RT5670_REG_RW,
+	[RT5670_CHARGE_PUMP] = RT5670_REG_RW,
+	[RT5670_MICBIAS] = RT5670_REG_RW,
+	[RT5670_A_JD_CTRL1] = RT5670_REG_RWV,
+	[RT5670_A_JD_CTRL2] = RT5670_REG_RWV,
+	[RT5670_VAD_CTRL1] = RT5670_REG_RW,
+	[RT5670_VAD_CTRL2] = RT5670_REG_RW,
+	[RT5670_VAD_CTRL3] = RT5670_REG_RW,
+	[RT5670_VAD_CTRL4] = RT5670_REG_RW,
+	[RT5670_VAD_CTRL5] = RT5670_REG_RWV,
+	[RT5670_ADC_EQ_CTRL1] = RT5670_REG_RWV,
+	[RT5670_ADC_EQ_CTRL2] = RT5670_REG_RW,
+	[RT5670_EQ_CTRL1] = RT5670_REG_RWV,
+	[RT5670_EQ_CTRL2] = RT5670_REG_RW,
+	[RT5670_ALC_DRC_CTRL1] = RT5670_REG_RW,
+	[RT5670_ALC_DRC_CTRL2] = RT5670_REG_RW,
+	[RT5670_ALC_CTRL_1] = RT5670_REG_RWV,
+	[RT5670_ALC_CTRL_2] = RT5670_REG_RW,
+	[RT5670_ALC_CTRL_3] = RT5670_REG_RW,
+	[RT5670_ALC_CTRL_4] = RT5670_REG_RW,
+	[RT5670_JD_CTRL] = RT5670_REG_RW,
+	[RT5670_IRQ_CTRL1] = RT5670_REG_RWV,
+	[RT5670_IRQ_CTRL2] = RT5670_REG_RWV,
+	[RT5670_INT_IRQ_ST] = RT5670_REG_RWV,
+	[RT5670_GPIO_CTRL1] = RT5670_REG_RW,
+	[RT5670_GPIO_CTRL2] = RT5670_REG_RW,
+	[RT5670_GPIO_CTRL3] = RT5670_REG_RW,
+	[RT5670_SCRABBLE_FUN] = RT5670_REG_RW,
+	[RT5670_SCRABBLE_CTRL] = RT5670_REG_RW,
+	[RT5670_BASE_BACK] = RT5670_REG_RW,
+	[RT5670_MP3_PLUS1] = RT5670_REG_RW,
+	[RT5670_MP3_PLUS2] = RT5670_REG_RW,
+	[RT5670_ADJ_HPF1] = RT5670_REG_RW,
+	[RT5670_ADJ_HPF2] = RT5670_REG_RW,
+	[RT5670_HP_CALIB_AMP_DET] = RT5670_REG_RW,
+	[RT5670_SV_ZCD1] = RT5670_REG_RW,
+	[RT5670_SV_ZCD2] = RT5670_REG_RW,
+	[RT5670_IL_CMD] = RT5670_REG_RWV,
+	[RT5670_IL_CMD2] = RT5670_REG_RW,
+	[RT5670_IL_CMD3] = RT5670_REG_RW,
+	[RT5670_DRC_HL_CTRL1] = RT5670_REG_RW,
+	[RT5670_DRC_HL_CTRL2] = RT5670_REG_RW,
+	[RT5670_ADC_MONO_HP_CTRL1] = RT5670_REG_RW,
+	[RT5670_ADC_MONO_HP_CTRL2] = RT5670_REG_RW,
+	[RT5670_ADC_STO2_HP_CTRL1] = RT5670_REG_RW,
+	[RT5670_ADC_STO2_HP_CTRL2] = RT5670_REG_RW,
+	[RT5670_JD_CTRL3] = RT5670_REG_RW,
+	[RT5670_JD_CTRL4] = RT5670_REG_RW,
+	[RT5670_DIG_MISC] = RT5670_REG_RW,
+	[RT5670_DSP_CTRL1] = RT5670_REG_RWV,
+	[RT5670_DSP_CTRL2] = RT5670_REG_RWV,
+	[RT5670_DSP_CTRL3] = RT5670_REG_RWV,
+	[RT5670_DSP_CTRL4] = RT5670_REG_RWV,
+	[RT5670_DSP_CTRL5] = RT5670_REG_RWV,
+	[RT5670_GEN_CTRL2] = RT5670_REG_RW,
+	[RT5670_GEN_CTRL3] = RT5670_REG_RW,
+	[RT5670_VENDOR_ID] = RT5670_REG_RV,
+	[RT5670_VENDOR_ID1] = RT5670_REG_RV,
+	[RT5670_VENDOR_ID2] = RT5670_REG_RV,
+};
+
+/*
+ * Access flags of the PR window. Only the control registers the driver
+ * programs itself are cached, the rest (ALC and EQ banks included) may
+ * be set up by firmware or hold calibration the codec updates on its
+ * own.
+ */
+static const u8 rt5670_pr_flags[RT5670_PR_MAX + 1] = {
+	[0 ... RT5670_PR_MAX] = RT5670_REG_RWV,
+	[RT5670_BIAS_CUR3] = RT5670_REG_RW,
+	[RT5670_MAMP_INT_REG2] = RT5670_REG_RW,
+	[RT5670_CHOP_DAC_ADC] = RT5670_REG_RW,
+};
+
+static unsigned int rt5670_reg_access(unsigned int reg)
 {
-	int i;
+	if (reg < ARRAY_SIZE(rt5670_reg_flags))
+		return rt5670_reg_flags[reg];
+	if (reg >= RT5670_PR_BASE && reg <= RT5670_PR_BASE + RT5670_PR_MAX)
+		return rt5670_pr_flags[reg - RT5670_PR_BASE];
 
-	for (i = 0; i < ARRAY_SIZE(rt5670_ranges); i++) {
-		if ((reg >= rt5670_ranges[i].window_start &&
-		     reg <= rt5670_ranges[i].window_start +
-		     rt5670_ranges[i].window_len) ||
-		    (reg >= rt5670_ranges[i].range_min &&
-		     reg <= rt5670_ranges[i].range_max)) {
-			return true;
-		}
-	}
+	return 0;
+}
 
-	switch (reg) {
-	case RT5670_RESET:
-	case RT5670_PDM_DATA_CTRL1:
-	case RT5670_PDM1_DATA_CTRL4:
-	case RT5670_PDM2_DATA_CTRL4:
-	case RT5670_PRIV_DATA:
-	case RT5670_ASRC_5:
-	case RT5670_CJ_CTRL1:
-	case RT5670_CJ_CTRL2:
-	case RT5670_CJ_CTRL3:
-	case RT5670_A_JD_CTRL1:
-	case RT5670_A_JD_CTRL2:
-	case RT5670_VAD_CTRL5:
-	case RT5670_ADC_EQ_CTRL1:
-	case RT5670_EQ_CTRL1:
-	case RT5670_ALC_CTRL_1:
-	case RT5670_IRQ_CTRL1:
-	case RT5670_IRQ_CTRL2:
-	case RT5670_INT_IRQ_ST:
-	case RT5670_IL_CMD:
-	case RT5670_DSP_CTRL1:
-	case RT5670_DSP_CTRL2:
-	case RT5670_DSP_CTRL3:
-	case RT5670_DSP_CTRL4:
-	case RT5670_DSP_CTRL5:
-	case RT5670_VENDOR_ID:
-	case RT5670_VENDOR_ID1:
-	case RT5670_VENDOR_ID2:
-		return true;
-	default:
-		return false;
-	}
+static bool rt5670_volatile_register(struct device *dev, unsigned int reg)
+{
+	return rt5670_reg_access(reg) & RT5670_REG_V;
 }
 
 static bool rt5670_readable_register(struct device *dev, unsigned int reg)
 {
-	int i;
+	return rt5670_reg_access(reg) & RT5670_REG_R;
+}
 
-	for (i = 0; i < ARRAY_SIZE(rt5670_ranges); i++) {
-		if ((reg >= rt5670_ranges[i].window_start &&
-		     reg <= rt5670_ranges[i].window_start +
-		     rt5670_ranges[i].window_len) ||
-		    (reg >= rt5670_ranges[i].range_min &&
-		     reg <= rt5670_ranges[i].range_max)) {
-			return true;
-		}
-	}
+static bool rt5670_writeable_register(struct device *dev, unsigned int reg)
+{
+	return rt5670_reg_access(reg) & RT5670_REG_W;
+}
 
-	switch (reg) {
-	case RT5670_RESET:
-	case RT5670_HP_VOL:
-	case RT5670_LOUT1:
-	case RT5670_CJ_CTRL1:
-	case RT5670_CJ_CTRL2:
-	case RT5670_CJ_CTRL3:
-	case RT5670_IN2:
-	case RT5670_INL1_INR1_VOL:
-	case RT5670_DAC1_DIG_VOL:
-	case RT5670_DAC2_DIG_VOL:
-	case RT5670_DAC_CTRL:
-	case RT5670_STO1_ADC_DIG_VOL:
-	case RT5670_MONO_ADC_DIG_VOL:
-	case RT5670_STO2_ADC_DIG_VOL:
-	case RT5670_ADC_BST_VOL1:
-	case RT5670_ADC_BST_VOL2:
-	case RT5670_STO2_ADC_MIXER:
-	case RT5670_STO1_ADC_MIXER:
-	case RT5670_MONO_ADC_MIXER:
-	case RT5670_AD_DA_MIXER:
-	case RT5670_STO_DAC_MIXER:
-	case RT5670_DD_MIXER:
-	case RT5670_DIG_MIXER:
-	case RT5670_DSP_PATH1:
-	case RT5670_DSP_PATH2:
-	case RT5670_DIG_INF1_DATA:
-	case RT5670_DIG_INF2_DATA:
-	case RT5670_PDM_OUT_CTRL:
-	case RT5670_PDM_DATA_CTRL1:
-	case RT5670_PDM1_DATA_CTRL2:
-	case RT5670_PDM1_DATA_CTRL3:
-	case RT5670_PDM1_DATA_CTRL4:
-	case RT5670_PDM2_DATA_CTRL2:
-	case RT5670_PDM2_DATA_CTRL3:
-	case RT5670_PDM2_DATA_CTRL4:
-	case RT5670_REC_L1_MIXER:
-	case RT5670_REC_L2_MIXER:
-	case RT5670_REC_R1_MIXER:
-	case RT5670_REC_R2_MIXER:
-	case RT5670_HPO_MIXER:
-	case RT5670_MONO_MIXER:
-	case RT5670_OUT_L1_MIXER:
-	case RT5670_OUT_R1_MIXER:
-	case RT5670_LOUT_MIXER:
-	case RT5670_PWR_DIG1:
-	case RT5670_PWR_DIG2:
-	case RT5670_PWR_ANLG1:
-	case RT5670_PWR_ANLG2:
-	case RT5670_PWR_MIXER:
-	case RT5670_PWR_VOL:
-	case RT5670_PRIV_INDEX:
-	case RT5670_PRIV_DATA:
-	case RT5670_I2S4_SDP:
-	case RT5670_I2S1_SDP:
-	case RT5670_I2S2_SDP:
-	case RT5670_I2S3_SDP:
-	case RT5670_ADDA_CLK1:
-	case RT5670_ADDA_CLK2:
-	case RT5670_DMIC_CTRL1:
-	case RT5670_DMIC_CTRL2:
-	case RT5670_TDM_CTRL_1:
-	case RT5670_TDM_CTRL_2:
-	case RT5670_TDM_CTRL_3:
-	case RT5670_DSP_CLK:
-	case RT5670_GLB_CLK:
-	case RT5670_PLL_CTRL1:
-	case RT5670_PLL_CTRL2:
-	case RT5670_ASRC_1:
-	case RT5670_ASRC_2:
-	case RT5670_ASRC_3:
-	case RT5670_ASRC_4:
-	case RT5670_ASRC_5:
-	case RT5670_ASRC_7:
-	case RT5670_ASRC_8:
-	case RT5670_ASRC_9:
-	case RT5670_ASRC_10:
-	case RT5670_ASRC_11:
-	case RT5670_ASRC_12:
-	case RT5670_ASRC_13:
-	case RT5670_ASRC_14:
-	case RT5670_DEPOP_M1:
-	case RT5670_DEPOP_M2:
-	case RT5670_DEPOP_M3:
-	case RT5670_CHARGE_PUMP:
-	case RT5670_MICBIAS:
-	case RT5670_A_JD_CTRL1:
-	case RT5670_A_JD_CTRL2:
-	case RT5670_VAD_CTRL1:
-	case RT5670_VAD_CTRL2:
-	case RT5670_VAD_CTRL3:
-	case RT5670_VAD_CTRL4:
-	case RT5670_VAD_CTRL5:
-	case RT5670_ADC_EQ_CTRL1:
-	case RT5670_ADC_EQ_CTRL2:
-	case RT5670_EQ_CTRL1:
-	case RT5670_EQ_CTRL2:
-	case RT5670_ALC_DRC_CTRL1:
-	case RT5670_ALC_DRC_CTRL2:
-	case RT5670_ALC_CTRL_1:
-	case RT5670_ALC_CTRL_2:
-	case RT5670_ALC_CTRL_3:
-	case RT5670_JD_CTRL:
-	case RT5670_IRQ_CTRL1:
-	case RT5670_IRQ_CTRL2:
-	case RT5670_INT_IRQ_ST:
-	case RT5670_GPIO_CTRL1:
-	case RT5670_GPIO_CTRL2:
-	case RT5670_GPIO_CTRL3:
-	case RT5670_SCRABBLE_FUN:
-	case RT5670_SCRABBLE_CTRL:
-	case RT5670_BASE_BACK:
-	case RT5670_MP3_PLUS1:
-	case RT5670_MP3_PLUS2:
-	case RT5670_ADJ_HPF1:
-	case RT5670_ADJ_HPF2:
-	case RT5670_HP_CALIB_AMP_DET:
-	case RT5670_SV_ZCD1:
-	case RT5670_SV_ZCD2:
-	case RT5670_IL_CMD:
-	case RT5670_IL_CMD2:
-	case RT5670_IL_CMD3:
-	case RT5670_DRC_HL_CTRL1:
-	case RT5670_DRC_HL_CTRL2:
-	case RT5670_ADC_MONO_HP_CTRL1:
-	case RT5670_ADC_MONO_HP_CTRL2:
-	case RT5670_ADC_STO2_HP_CTRL1:
-	case RT5670_ADC_STO2_HP_CTRL2:
-	case RT5670_JD_CTRL3:
-	case RT5670_JD_CTRL4:
-	case RT5670_DIG_MISC:
-	case RT5670_DSP_CTRL1:
-	case RT5670_DSP_CTRL2:
-	case RT5670_DSP_CTRL3:
-	case RT5670_DSP_CTRL4:
-	case RT5670_DSP_CTRL5:
-	case RT5670_GEN_CTRL2:
-	case RT5670_GEN_CTRL3:
-	case RT5670_VENDOR_ID:
-	case RT5670_VENDOR_ID1:
-	case RT5670_VENDOR_ID2:
-		return true;
-	default:
-		return false;
+/*
+ * Writes with the cache bypassed move PRIV_INDEX behind the cache's
+ * back. Park the cached index on a page that does not exist, so the
+ * next PR access always selects its page on the chip.
+ */
+static void rt5670_pr_index_forget(struct regmap *regmap)
+{
+	regcache_cache_only(regmap, true);
+	regmap_write(regmap, RT5670_PRIV_INDEX, 0xff);
+	regcache_cache_only(regmap, false);
+}
+
+/*
+ * The PR registers have no documented reset values, so the cached ones
+ * are read from the chip once the init patch is in place.
+ */
+static int rt5670_pr_cache_init(struct regmap *regmap)
+{
+	unsigned int i, val;
+	int ret = 0;
+
+	for (i = 0; i <= RT5670_PR_MAX; i++) {
+		if (rt5670_pr_flags[i] & RT5670_REG_V)
+			continue;
+
+		regcache_cache_bypass(regmap, true);
+		ret = regmap_read(regmap, RT5670_PR_BASE + i, &val);
+		regcache_cache_bypass(regmap, false);
+		if (ret < 0)
+			break;
+
+		regcache_cache_only(regmap, true);
+		regmap_write(regmap, RT5670_PR_BASE + i, val);
+		regcache_cache_only(regmap, false);
 	}
+	rt5670_pr_index_forget(regmap);
+
+	return ret;
 }
 
-int rt5670_write_fw(struct snd_soc_codec *codec, const struct firmware *fw,
-		unsigned int pos, unsigned int num)
+/**
+ * rt5670_pr_write - Write a run of consecutive PR registers.
+ * @regmap: Codec register map.
+ * @addr: First PR index.
+ * @vals: Register values.
+ * @num: Number of registers.
+ *
+ * Cached registers that already hold their value are skipped, so
+ * neither the index nor the data goes out for them. The window is one
+ * register wide, a bulk write would not save any index writes.
+ *
+ * Returns 0 for success or negative error code.
+ */
+int rt5670_pr_write(struct regmap *regmap, unsigned int addr,
+		const u16 *vals, unsigned int num)
 {
-	int i, ret;
+	unsigned int i, reg;
+	int ret;
 
 	for (i = 0; i < num; i++) {
-		switch(fw->data[pos]) {
-		case 1: /*PR*/
-			ret = snd_soc_write(codec, RT5670_PR_BASE +
-				((fw->data[pos + 1] << 8) | fw->data[pos + 2]),
-				(fw->data[pos + 3] << 8) | fw->data[pos + 4]);
-			if (ret < 0)
-				return -1;
-			break;
-		case 2: /*dsp*/
-			ret = rt5670_dsp_write(codec,
-				(fw->data[pos + 1] << 8) | fw->data[pos + 2],
-				(fw->data[pos + 3] << 8) | fw->data[pos + 4]);
+		reg = RT5670_PR_BASE + addr + i;
+		if (rt5670_reg_access(reg) & RT5670_REG_V)
+			ret = regmap_write(regmap, reg, vals[i]);
+		else
+			ret = regmap_update_bits(regmap, reg, 0xffff, vals[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * rt5670_write_fw - Replay a pre-parsed DSP mode table.
+ * @codec: SoC audio codec device.
+ * @tab: Mode table built by rt5670_dsp_fw_loaded().
+ *
+ * Each op covers a run of consecutive addresses of one type. Plain
+ * register runs are sent as one multi-register write, PR runs skip
+ * cached registers already holding their value and DSP runs go
+ * through the DSP command interface one word at a time and skip words
+ * the DSP already holds. The whole table is one DSP command batch.
+ *
+ * Returns the number of records written or negative error code.
+ */
+int rt5670_write_fw(struct snd_soc_codec *codec,
+		const struct rt5670_dsp_mode *tab)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	const struct rt5670_dsp_op *op;
+	const u16 *val;
+	unsigned int i, reg;
+	int ret = 0, count = 0;
+
+	rt5670_dsp_begin(codec);
+
+	for (i = 0; i < tab->num_ops; i++) {
+		op = &tab->ops[i];
+		val = &tab->vals[op->idx];
+
+		switch (op->type) {
+		case RT5670_DSP_OP_PR:
+			ret = rt5670_pr_write(rt5670->regmap, op->addr, val,
+				op->len);
 			if (ret < 0)
-				return -1;
-			break;
-		default: /*register*/
-			ret = snd_soc_write(codec,
-				(fw->data[pos + 1] << 8) | fw->data[pos + 2],
-				(fw->data[pos + 3] << 8) | fw->data[pos + 4]);
+				goto out;
+			count += op->len;
+			continue;
+		case RT5670_DSP_OP_DSP:
+			ret = rt5670_dsp_write_run(codec, op, val);
 			if (ret < 0)
-				return -1;
+				goto out;
+			count += ret;
+			continue;
+		default:
+			reg = op->addr;
 			break;
 		}
-		pos += 5;
-		if (fw->size < pos)
-			return 0;
+
+		if (op->len == 1)
+			ret = regmap_write(rt5670->regmap, reg, val[0]);
+		else
+			ret = regmap_bulk_write(rt5670->regmap, reg, val,
+				op->len);
+		if (ret < 0)
+			goto out;
+		count += op->len;
 	}
 
-	return 0;
-	
+out:
+	rt5670_dsp_commit(codec);
+	if (ret < 0)
+		return ret;
+
+	return count;
 }
 
 static const DECLARE_TLV_DB_SCALE(out_vol_tlv, -4650, 150, 0);
@@ -994,17 +1062,167 @@ static const char * const rt5670_dsp_bypass_src[] = {
 	"DSP", "Bypass"
 };
 
+#define RT5670_DIG_VOL_RAMP_STEPS	8
+
+/**
+ * rt5670_dig_vol_ramp - Step a stereo digital volume to a new setting.
+ * @codec: SoC audio codec device.
+ * @reg: Digital volume register, left channel in the high byte.
+ * @mask: Volume field mask of one channel.
+ * @from: Register value to start from.
+ * @to: Register value to end at.
+ *
+ * Soft volume has to be enabled, so the codec smooths every step.
+ */
+static void rt5670_dig_vol_ramp(struct snd_soc_codec *codec,
+		unsigned int reg, unsigned int mask, unsigned int from,
+		unsigned int to)
+{
+	int fl = (from >> 8) & mask, fr = from & mask;
+	int tl = (to >> 8) & mask, tr = to & mask;
+	int i, l, r;
+
+	for (i = 1; i <= RT5670_DIG_VOL_RAMP_STEPS; i++) {
+		l = fl + (tl - fl) * i / RT5670_DIG_VOL_RAMP_STEPS;
+		r = fr + (tr - fr) * i / RT5670_DIG_VOL_RAMP_STEPS;
+		snd_soc_update_bits(codec, reg, mask << 8 | mask,
+			l << 8 | r);
+		usleep_range(1000, 1500);
+	}
+}
+
+/* ADC volume feeding each TxDP slot pair, none for the IF2 DAC slots */
+static const unsigned int rt5670_txdp_slot_vol[] = {
+	RT5670_STO1_ADC_DIG_VOL, RT5670_MONO_ADC_DIG_VOL,
+	RT5670_STO2_ADC_DIG_VOL, 0,
+};
+
+/*
+ * Flipping a DSP bypass mux mid-stream is an audible step, so while
+ * the codec is running the volume behind the mux is ramped down around
+ * the flip: DAC2 for the downlink (TxDC_DAC feeds DAC L2/R2), the ADC
+ * of the selected TDM slot pair for the uplink. Slots 6-7 carry the
+ * IF2 DAC data, which has no digital volume, and are flipped as is.
+ */
+static int rt5670_dsp_bypass_write(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_dapm_kcontrol_codec(kcontrol);
+	struct soc_enum *e = (struct soc_enum *)kcontrol->private_value;
+	unsigned int cur, reg, mask, vol, sv, slot;
+	int ret;
+
+	cur = (snd_soc_read(codec, e->reg) >> e->shift_l) & e->mask;
+	if (cur == ucontrol->value.enumerated.item[0] ||
+	    codec->dapm.bias_level != SND_SOC_BIAS_ON)
+		return snd_soc_dapm_put_enum_double(kcontrol, ucontrol);
+
+	if (e->shift_l == RT5670_DSP_DL_SFT) {
+		reg = RT5670_DAC2_DIG_VOL;
+		mask = RT5670_DAC_R2_VOL_MASK;
+	} else {
+		slot = (snd_soc_read(codec, RT5670_DSP_PATH1) &
+			RT5670_TXDP_SLOT_SEL_MASK) >> RT5670_TXDP_SLOT_SEL_SFT;
+		reg = rt5670_txdp_slot_vol[slot];
+		mask = RT5670_ADC_R_VOL_MASK;
+		if (!reg)
+			return snd_soc_dapm_put_enum_double(kcontrol,
+				ucontrol);
+	}
+
+	vol = snd_soc_read(codec, reg);
+	sv = snd_soc_read(codec, RT5670_SV_ZCD1);
+	snd_soc_update_bits(codec, RT5670_SV_ZCD1,
+		RT5670_SV_MASK | RT5670_ZCD_DIG_MASK,
+		RT5670_SV_EN | RT5670_ZCD_DIG_EN);
+
+	rt5670_dig_vol_ramp(codec, reg, mask, vol, 0);
+	ret = snd_soc_dapm_put_enum_double(kcontrol, ucontrol);
+	rt5670_dig_vol_ramp(codec, reg, mask, 0, vol);
+
+	snd_soc_update_bits(codec, RT5670_SV_ZCD1,
+		RT5670_SV_MASK | RT5670_ZCD_DIG_MASK, sv);
+
+	return ret;
+}
+
+/* While the DSP code holds the mux in bypass, report the user setting */
+static int rt5670_dsp_bypass_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_dapm_kcontrol_codec(kcontrol);
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct soc_enum *e = (struct soc_enum *)kcontrol->private_value;
+	bool held;
+
+	mutex_lock(&rt5670->dsp_mux_lock);
+	held = rt5670->dsp_mux_held & (e->mask << e->shift_l);
+	ucontrol->value.enumerated.item[0] =
+		(rt5670->dsp_mux_saved >> e->shift_l) & e->mask;
+	mutex_unlock(&rt5670->dsp_mux_lock);
+
+	if (held)
+		return 0;
+
+	return snd_soc_dapm_get_enum_double(kcontrol, ucontrol);
+}
+
+/*
+ * While the DSP code holds the mux in bypass only the user setting and
+ * the DAPM path are updated; the register follows on release.
+ */
+static int rt5670_dsp_bypass_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_codec *codec = snd_soc_dapm_kcontrol_codec(kcontrol);
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct soc_enum *e = (struct soc_enum *)kcontrol->private_value;
+	unsigned int item = ucontrol->value.enumerated.item[0];
+	unsigned int bit = e->mask << e->shift_l;
+	bool held, change;
+	int ret;
+
+	if (item >= e->items)
+		return -EINVAL;
+
+	mutex_lock(&rt5670->dsp_mux_lock);
+	change = ((rt5670->dsp_mux_saved >> e->shift_l) & e->mask) != item;
+	rt5670->dsp_mux_saved = (rt5670->dsp_mux_saved & ~bit) |
+		(item << e->shift_l);
+	held = rt5670->dsp_mux_held & bit;
+	mutex_unlock(&rt5670->dsp_mux_lock);
+
+	if (held) {
+		ret = snd_soc_dapm_mux_update_power(
+			snd_soc_dapm_kcontrol_dapm(kcontrol), kcontrol, item,
+			e, NULL);
+		return ret < 0 ? ret : change;
+	}
+
+	ret = rt5670_dsp_bypass_write(kcontrol, ucontrol);
+
+	/* a hold that started meanwhile keeps the mux in bypass */
+	mutex_lock(&rt5670->dsp_mux_lock);
+	if (rt5670->dsp_mux_held & bit)
+		snd_soc_update_bits(codec, e->reg, bit, bit);
+	mutex_unlock(&rt5670->dsp_mux_lock);
+
+	return ret;
+}
+
 static SOC_ENUM_SINGLE_DECL(rt5670_dsp_ul_enum, RT5670_DSP_PATH1,
 	RT5670_DSP_UL_SFT, rt5670_dsp_bypass_src);
 
 static const struct snd_kcontrol_new rt5670_dsp_ul_mux =
-	SOC_DAPM_ENUM("DSP UL source", rt5670_dsp_ul_enum);
+	SOC_DAPM_ENUM_EXT("DSP UL source", rt5670_dsp_ul_enum,
+		rt5670_dsp_bypass_get, rt5670_dsp_bypass_put);
 
 static SOC_ENUM_SINGLE_DECL(rt5670_dsp_dl_enum, RT5670_DSP_PATH1,
 	RT5670_DSP_DL_SFT, rt5670_dsp_bypass_src);
 
 static const struct snd_kcontrol_new rt5670_dsp_dl_mux =
-	SOC_DAPM_ENUM("DSP DL source", rt5670_dsp_dl_enum);
+	SOC_DAPM_ENUM_EXT("DSP DL source", rt5670_dsp_dl_enum,
+		rt5670_dsp_bypass_get, rt5670_dsp_bypass_put);
 
 /* Stereo2 ADC source */
 /* MX-26 [15] */
@@ -1286,83 +1504,264 @@ static SOC_ENUM_SINGLE_DECL(rt5670_vad_adc_enum, RT5670_VAD_CTRL4,
 static const struct snd_kcontrol_new rt5670_vad_adc_mux =
 	SOC_DAPM_ENUM("VAD ADC source", rt5670_vad_adc_enum);
 
+/*
+ * Register sequences for the power events. Consecutive writes to
+ * consecutive addresses go out as one bulk transfer, in table order,
+ * and consecutive delays are merged, a sleeping delay anywhere in a run
+ * makes the whole run sleep. Writes are never reordered.
+ */
+enum {
+	RT5670_SEQ_WRITE,
+	RT5670_SEQ_UPDATE,
+	RT5670_SEQ_MDELAY,
+	RT5670_SEQ_MSLEEP,
+};
+
+struct rt5670_seq {
+	u8 op;
+	u16 reg;
+	u16 mask;
+	u16 val;
+};
+
+#define RT5670_SEQ_W(r, v) \
+	{ .op = RT5670_SEQ_WRITE, .reg = (r), .val = (v) }
+#define RT5670_SEQ_U(r, m, v) \
+	{ .op = RT5670_SEQ_UPDATE, .reg = (r), .mask = (m), .val = (v) }
+#define RT5670_SEQ_MDELAY(ms) \
+	{ .op = RT5670_SEQ_MDELAY, .val = (ms) }
+#define RT5670_SEQ_MSLEEP(ms) \
+	{ .op = RT5670_SEQ_MSLEEP, .val = (ms) }
+
+#define RT5670_SEQ_BATCH		16
+
+struct rt5670_seq_state {
+	unsigned int writes; /* register writes asked for */
+	unsigned int xfers; /* bus write transfers issued */
+	unsigned int num_pend;
+	struct reg_default pend[RT5670_SEQ_BATCH];
+};
+
+static bool rt5670_seq_is_delay(const struct rt5670_seq *step)
+{
+	return step->op == RT5670_SEQ_MDELAY || step->op == RT5670_SEQ_MSLEEP;
+}
+
+/* Send the pending registers as runs of consecutive addresses. */
+static int rt5670_seq_flush(struct snd_soc_codec *codec,
+		struct rt5670_seq_state *st)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	struct reg_default *pend = st->pend;
+	u16 vals[RT5670_SEQ_BATCH];
+	unsigned int i, n;
+	int ret;
+
+	for (i = 0; i < st->num_pend; i += n) {
+		for (n = 0; i + n < st->num_pend; n++) {
+			if (pend[i + n].reg != pend[i].reg + n)
+				break;
+			vals[n] = pend[i + n].def;
+		}
+
+		if (n == 1)
+			ret = regmap_write(rt5670->regmap, pend[i].reg,
+				vals[0]);
+		else
+			ret = regmap_bulk_write(rt5670->regmap, pend[i].reg,
+				vals, n);
+		if (ret < 0)
+			return ret;
+		st->xfers++;
+	}
+	st->num_pend = 0;
+
+	return 0;
+}
+
+/**
+ * rt5670_seq_step - Run one step of a register sequence.
+ * @codec: SoC audio codec device.
+ * @st: Sequence state.
+ * @seq: Register sequence.
+ * @num: Number of entries in @seq.
+ * @i: Index of the step; advanced past every entry it consumed.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_seq_step(struct snd_soc_codec *codec,
+		struct rt5670_seq_state *st, const struct rt5670_seq *seq,
+		int num, int *i)
+{
+	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
+	const struct rt5670_seq *step = &seq[*i];
+	unsigned int delay = 0;
+	bool sleep = false, change;
+	int ret;
+
+	switch (step->op) {
+	case RT5670_SEQ_WRITE:
+		/* queued in table order, flushed as consecutive-address runs */
+		while (*i < num && seq[*i].op == RT5670_SEQ_WRITE &&
+		       st->num_pend < RT5670_SEQ_BATCH) {
+			st->pend[st->num_pend].reg = seq[*i].reg;
+			st->pend[st->num_pend].def = seq[*i].val;
+			st->num_pend++;
+			st->writes++;
+			(*i)++;
+		}
+		return rt5670_seq_flush(codec, st);
+
+	case RT5670_SEQ_UPDATE:
+		(*i)++;
+		st->writes++;
+		ret = regmap_update_bits_check(rt5670->regmap, step->reg,
+			step->mask, step->val, &change);
+		if (change)
+			st->xfers++;
+		return ret;
+
+	default:
+		while (*i < num && rt5670_seq_is_delay(&seq[*i])) {
+			delay += seq[*i].val;
+			sleep |= seq[*i].op == RT5670_SEQ_MSLEEP;
+			(*i)++;
+		}
+		if (sleep)
+			msleep(delay);
+		else
+			mdelay(delay);
+		return 0;
+	}
+}
+
+/**
+ * rt5670_seq_run - Run a register sequence.
+ * @codec: SoC audio codec device.
+ * @name: Sequence name for the debug log.
+ * @seq: Register sequence.
+ * @num: Number of entries in @seq.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int rt5670_seq_run(struct snd_soc_codec *codec, const char *name,
+		const struct rt5670_seq *seq, int num)
+{
+	struct rt5670_seq_state st = { 0 };
+	ktime_t start, last, now;
+	int i = 0, first, ret = 0;
+
+	start = last = ktime_get();
+	while (i < num) {
+		first = i;
+		ret = rt5670_seq_step(codec, &st, seq, num, &i);
+		if (ret < 0) {
+			dev_err(codec->dev, "%s: step %d failed: %d\n",
+				name, first, ret);
+			return ret;
+		}
+
+		now = ktime_get();
+		dev_dbg(codec->dev, "%s: steps %d-%d in %lld us\n",
+			name, first, i - 1, ktime_us_delta(now, last));
+		last = now;
+	}
+	dev_dbg(codec->dev, "%s: %u writes in %u transfers, done in %lld us\n",
+		name, st.writes, st.xfers, ktime_us_delta(last, start));
+
+	return 0;
+}
+
+#define rt5670_seq(codec, seq) \
+	rt5670_seq_run(codec, #seq, seq, ARRAY_SIZE(seq))
+
+static const struct rt5670_seq rt5670_hp_power_on[] = {
+	RT5670_SEQ_U(RT5670_CHARGE_PUMP, RT5670_PM_HP_MASK, RT5670_PM_HP_HV),
+	RT5670_SEQ_U(RT5670_GEN_CTRL2, 0x0400, 0x0400),
+	/* headphone amp power on */
+	RT5670_SEQ_U(RT5670_PWR_ANLG1,
+		RT5670_PWR_HA | RT5670_PWR_FV1 | RT5670_PWR_FV2,
+		RT5670_PWR_HA | RT5670_PWR_FV1 | RT5670_PWR_FV2),
+	/* depop parameters */
+	RT5670_SEQ_W(RT5670_DEPOP_M2, 0x3100),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x8009),
+	RT5670_SEQ_W(RT5670_PR_BASE + RT5670_HP_DCC_INT1, 0x9f00),
+	RT5670_SEQ_MDELAY(20),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x8019),
+};
+
+static const struct rt5670_seq rt5670_hp_power_off[] = {
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x0004),
+	RT5670_SEQ_MSLEEP(30),
+};
+
 static int rt5670_hp_power_event(struct snd_soc_dapm_widget *w,
 			   struct snd_kcontrol *kcontrol, int event)
 {
 	struct snd_soc_codec *codec = w->codec;
-	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
 
 	switch (event) {
 	case SND_SOC_DAPM_POST_PMU:
-		regmap_update_bits(rt5670->regmap, RT5670_CHARGE_PUMP,
-			RT5670_PM_HP_MASK, RT5670_PM_HP_HV);
-		regmap_update_bits(rt5670->regmap, RT5670_GEN_CTRL2,
-			0x0400, 0x0400);
-		/* headphone amp power on */
-		regmap_update_bits(rt5670->regmap, RT5670_PWR_ANLG1,
-			RT5670_PWR_HA |	RT5670_PWR_FV1 |
-			RT5670_PWR_FV2,	RT5670_PWR_HA |
-			RT5670_PWR_FV1 | RT5670_PWR_FV2);
-		/* depop parameters */
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M2, 0x3100);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x8009);
-		regmap_write(rt5670->regmap, RT5670_PR_BASE +
-			RT5670_HP_DCC_INT1, 0x9f00);
-		mdelay(20);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x8019);
-		break;
+		return rt5670_seq(codec, rt5670_hp_power_on);
 	case SND_SOC_DAPM_PRE_PMD:
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x0004);
-		msleep(30);
-		break;
+		return rt5670_seq(codec, rt5670_hp_power_off);
 	default:
 		return 0;
 	}
-
-	return 0;
 }
 
+/* headphone unmute sequence */
+static const struct rt5670_seq rt5670_hp_unmute[] = {
+	RT5670_SEQ_W(RT5670_PR_BASE + RT5670_MAMP_INT_REG2, 0xb400),
+	RT5670_SEQ_W(RT5670_DEPOP_M3, 0x0772),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x805d),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x831d),
+	RT5670_SEQ_U(RT5670_GEN_CTRL2, 0x0300, 0x0300),
+	RT5670_SEQ_U(RT5670_HP_VOL, RT5670_L_MUTE | RT5670_R_MUTE, 0),
+	RT5670_SEQ_MSLEEP(80),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x8019),
+};
+
+/* headphone mute sequence */
+static const struct rt5670_seq rt5670_hp_mute[] = {
+	RT5670_SEQ_W(RT5670_PR_BASE + RT5670_MAMP_INT_REG2, 0xb400),
+	RT5670_SEQ_W(RT5670_DEPOP_M3, 0x0772),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x803d),
+	RT5670_SEQ_MDELAY(10),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x831d),
+	RT5670_SEQ_MDELAY(10),
+	RT5670_SEQ_U(RT5670_HP_VOL, RT5670_L_MUTE | RT5670_R_MUTE,
+		RT5670_L_MUTE | RT5670_R_MUTE),
+	RT5670_SEQ_MSLEEP(20),
+	RT5670_SEQ_U(RT5670_GEN_CTRL2, 0x0300, 0x0),
+	RT5670_SEQ_W(RT5670_DEPOP_M1, 0x8019),
+	RT5670_SEQ_W(RT5670_DEPOP_M3, 0x0707),
+	RT5670_SEQ_W(RT5670_PR_BASE + RT5670_MAMP_INT_REG2, 0xfc00),
+};
+
 static int rt5670_hp_event(struct snd_soc_dapm_widget *w,
 	struct snd_kcontrol *kcontrol, int event)
 {
 	struct snd_soc_codec *codec = w->codec;
-	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
 
 	switch (event) {
 	case SND_SOC_DAPM_POST_PMU:
-		/* headphone unmute sequence */
-		regmap_write(rt5670->regmap, RT5670_PR_BASE +
-				RT5670_MAMP_INT_REG2, 0xb400);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M3, 0x0772);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x805d);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x831d);
-		regmap_update_bits(rt5670->regmap, RT5670_GEN_CTRL2,
-				0x0300, 0x0300);
-		regmap_update_bits(rt5670->regmap, RT5670_HP_VOL,
-			RT5670_L_MUTE | RT5670_R_MUTE, 0);
-		msleep(80);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x8019);
-		break;
-
+		return rt5670_seq(codec, rt5670_hp_unmute);
 	case SND_SOC_DAPM_PRE_PMD:
-		/* headphone mute sequence */
-		regmap_write(rt5670->regmap, RT5670_PR_BASE +
-				RT5670_MAMP_INT_REG2, 0xb400);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M3, 0x0772);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x803d);
-		mdelay(10);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x831d);
-		mdelay(10);
-		regmap_update_bits(rt5670->regmap, RT5670_HP_VOL,
-				   RT5670_L_MUTE | RT5670_R_MUTE,
-				   RT5670_L_MUTE | RT5670_R_MUTE);
-		msleep(20);
-		regmap_update_bits(rt5670->regmap,
-				   RT5670_GEN_CTRL2, 0x0300, 0x0);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M1, 0x8019);
-		regmap_write(rt5670->regmap, RT5670_DEPOP_M3, 0x0707);
-		regmap_write(rt5670->regmap, RT5670_PR_BASE +
-				RT5670_MAMP_INT_REG2, 0xfc00);
+		return rt5670_seq(codec, rt5670_hp_mute);
+	default:
+		return 0;
+	}
+}
+
+static int rt5670_i2s_dsp_event(struct snd_soc_dapm_widget *w,
+	struct snd_kcontrol *kcontrol, int event)
+{
+	struct snd_soc_codec *codec = w->codec;
+
+	switch (event) {
+	case SND_SOC_DAPM_POST_PMD:
+		rt5670_dsp_power_off(codec);
 		break;
 
 	default:
@@ -1422,7 +1821,8 @@ static const struct snd_soc_dapm_widget rt5670_dapm_widgets[] = {
 	SND_SOC_DAPM_SUPPLY("PLL1", RT5670_PWR_ANLG2,
 			    RT5670_PWR_PLL_BIT, 0, NULL, 0),
 	SND_SOC_DAPM_SUPPLY("I2S DSP", RT5670_PWR_DIG2,
-			    RT5670_PWR_I2S_DSP_BIT, 0, NULL, 0),
+			    RT5670_PWR_I2S_DSP_BIT, 0, rt5670_i2s_dsp_event,
+			    SND_SOC_DAPM_POST_PMD),
 	SND_SOC_DAPM_SUPPLY("Mic Det Power", RT5670_PWR_VOL,
 			    RT5670_PWR_MIC_DET_BIT, 0, NULL, 0),
 
@@ -2222,6 +2622,8 @@ static int rt5670_hw_params(struct snd_pcm_substream *substream,
 		return -EINVAL;
 	}
 
+	rt5670_dsp_hw_params(codec, rt5670->lrck[dai->id]);
+
 	return 0;
 }
 
@@ -2440,44 +2842,54 @@ static int rt5670_set_tdm_slot(struct snd_soc_dai *dai, unsigned int tx_mask,
 	return 0;
 }
 
+static const struct rt5670_seq rt5670_bias_prepare[] = {
+	RT5670_SEQ_U(RT5670_PWR_ANLG1,
+		RT5670_PWR_VREF1 | RT5670_PWR_MB |
+		RT5670_PWR_BG | RT5670_PWR_VREF2,
+		RT5670_PWR_VREF1 | RT5670_PWR_MB |
+		RT5670_PWR_BG | RT5670_PWR_VREF2),
+	RT5670_SEQ_MDELAY(10),
+	RT5670_SEQ_U(RT5670_PWR_ANLG1, RT5670_PWR_FV1 | RT5670_PWR_FV2,
+		RT5670_PWR_FV1 | RT5670_PWR_FV2),
+	RT5670_SEQ_U(RT5670_CHARGE_PUMP,
+		RT5670_OSW_L_MASK | RT5670_OSW_R_MASK,
+		RT5670_OSW_L_DIS | RT5670_OSW_R_DIS),
+	RT5670_SEQ_U(RT5670_DIG_MISC, 0x1, 0x1),
+	RT5670_SEQ_U(RT5670_PWR_ANLG1, RT5670_LDO_SEL_MASK, 0x3),
+};
+
+static const struct rt5670_seq rt5670_bias_standby[] = {
+	RT5670_SEQ_W(RT5670_PWR_DIG1, 0x0000),
+	RT5670_SEQ_W(RT5670_PWR_DIG2, 0x0001),
+	RT5670_SEQ_W(RT5670_PWR_VOL, 0x0000),
+	RT5670_SEQ_W(RT5670_PWR_MIXER, 0x0001),
+	RT5670_SEQ_W(RT5670_PWR_ANLG1, 0x2800),
+	RT5670_SEQ_W(RT5670_PWR_ANLG2, 0x0004),
+	RT5670_SEQ_U(RT5670_DIG_MISC, 0x1, 0x0),
+	RT5670_SEQ_U(RT5670_PWR_ANLG1, RT5670_LDO_SEL_MASK, 0x1),
+};
+
 static int rt5670_set_bias_level(struct snd_soc_codec *codec,
 			enum snd_soc_bias_level level)
 {
+	int ret = 0;
+
 	switch (level) {
 	case SND_SOC_BIAS_PREPARE:
-		if (SND_SOC_BIAS_STANDBY == codec->dapm.bias_level) {
-			snd_soc_update_bits(codec, RT5670_PWR_ANLG1,
-				RT5670_PWR_VREF1 | RT5670_PWR_MB |
-				RT5670_PWR_BG | RT5670_PWR_VREF2,
-				RT5670_PWR_VREF1 | RT5670_PWR_MB |
-				RT5670_PWR_BG | RT5670_PWR_VREF2);
-			mdelay(10);
-			snd_soc_update_bits(codec, RT5670_PWR_ANLG1,
-				RT5670_PWR_FV1 | RT5670_PWR_FV2,
-				RT5670_PWR_FV1 | RT5670_PWR_FV2);
-			snd_soc_update_bits(codec, RT5670_CHARGE_PUMP,
-				RT5670_OSW_L_MASK | RT5670_OSW_R_MASK,
-				RT5670_OSW_L_DIS | RT5670_OSW_R_DIS);
-			snd_soc_update_bits(codec, RT5670_DIG_MISC, 0x1, 0x1);
-			snd_soc_update_bits(codec, RT5670_PWR_ANLG1,
-				RT5670_LDO_SEL_MASK, 0x3);
-		}
+		if (SND_SOC_BIAS_STANDBY == codec->dapm.bias_level)
+			ret = rt5670_seq(codec, rt5670_bias_prepare);
 		break;
 	case SND_SOC_BIAS_STANDBY:
-		snd_soc_write(codec, RT5670_PWR_DIG1, 0x0000);
-		snd_soc_write(codec, RT5670_PWR_DIG2, 0x0001);
-		snd_soc_write(codec, RT5670_PWR_VOL, 0x0000);
-		snd_soc_write(codec, RT5670_PWR_MIXER, 0x0001);
-		snd_soc_write(codec, RT5670_PWR_ANLG1, 0x2800);
-		snd_soc_write(codec, RT5670_PWR_ANLG2, 0x0004);
-		snd_soc_update_bits(codec, RT5670_DIG_MISC, 0x1, 0x0);
-		snd_soc_update_bits(codec, RT5670_PWR_ANLG1,
-				RT5670_LDO_SEL_MASK, 0x1);
+		/* clears PWR_I2S_DSP */
+		rt5670_dsp_power_off(codec);
+		ret = rt5670_seq(codec, rt5670_bias_standby);
 		break;
 
 	default:
 		break;
 	}
+	if (ret < 0)
+		return ret;
 	codec->dapm.bias_level = level;
 
 	return 0;
@@ -2497,6 +2909,7 @@ static int rt5670_remove(struct snd_soc_codec *codec)
 {
 	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
 
+	rt5670_dsp_remove(codec);
 	regmap_write(rt5670->regmap, RT5670_RESET, 0);
 	return 0;
 }
@@ -2506,6 +2919,7 @@ static int rt5670_suspend(struct snd_soc_codec *codec)
 {
 	struct rt5670_priv *rt5670 = snd_soc_codec_get_drvdata(codec);
 
+	rt5670_dsp_suspend(codec);
 	regcache_cache_only(rt5670->regmap, true);
 	regcache_mark_dirty(rt5670->regmap);
 	return 0;
@@ -2517,6 +2931,8 @@ static int rt5670_resume(struct snd_soc_codec *codec)
 
 	regcache_cache_only(rt5670->regmap, false);
 	regcache_sync(rt5670->regmap);
+	rt5670_pr_index_forget(rt5670->regmap);
+	rt5670_dsp_resume(codec);
 
 	return 0;
 }
@@ -2596,17 +3012,34 @@ static struct snd_soc_codec_driver soc_codec_dev_rt5670 = {
 static const struct regmap_config rt5670_regmap = {
 	.reg_bits = 8,
 	.val_bits = 16,
-	.max_register = RT5670_VENDOR_ID2 + 1 + (ARRAY_SIZE(rt5670_ranges) *
-					       RT5670_PR_SPACING),
+	.max_register = RT5670_PR_BASE + RT5670_PR_MAX,
 	.volatile_reg = rt5670_volatile_register,
 	.readable_reg = rt5670_readable_register,
-	.cache_type = REGCACHE_RBTREE,
+	.writeable_reg = rt5670_writeable_register,
+	.cache_type = REGCACHE_FLAT,
 	.reg_defaults = rt5670_reg,
 	.num_reg_defaults = ARRAY_SIZE(rt5670_reg),
 	.ranges = rt5670_ranges,
 	.num_ranges = ARRAY_SIZE(rt5670_ranges),
 };
 
+#ifdef DEBUG
+/* Compare rt5670_reg with the chip, the cache must be bypassed */
+static void rt5670_check_defaults(struct device *dev, struct regmap *regmap)
+{
+	unsigned int val;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(rt5670_reg); i++) {
+		if (regmap_read(regmap, rt5670_reg[i].reg, &val))
+			continue;
+		if (val != rt5670_reg[i].def)
+			dev_warn(dev, "Reg %#04x resets to %#06x, not %#06x\n",
+				rt5670_reg[i].reg, val, rt5670_reg[i].def);
+	}
+}
+#endif
+
 static const struct i2c_device_id rt5670_i2c_id[] = {
 	{ "rt5670", 0 },
 	{ }
@@ -2647,6 +3080,8 @@ static int rt5670_i2c_probe(struct i2c_client *i2c,
 		return -ENODEV;
 	}
 
+	/* keep the cache at the reset defaults across the reset dance */
+	regcache_cache_bypass(rt5670->regmap, true);
 	regmap_write(rt5670->regmap, RT5670_RESET, 0);
 	regmap_update_bits(rt5670->regmap, RT5670_PWR_ANLG1,
 		RT5670_PWR_HP_L | RT5670_PWR_HP_R |
@@ -2654,12 +3089,22 @@ static int rt5670_i2c_probe(struct i2c_client *i2c,
 	msleep(100);
 
 	regmap_write(rt5670->regmap, RT5670_RESET, 0);
+#ifdef DEBUG
+	rt5670_check_defaults(&i2c->dev, rt5670->regmap);
+#endif
+	regcache_cache_bypass(rt5670->regmap, false);
 
 	ret = regmap_register_patch(rt5670->regmap, init_list,
 				    ARRAY_SIZE(init_list));
 	if (ret != 0)
 		dev_warn(&i2c->dev, "Failed to apply regmap patch: %d\n", ret);
 
+	ret = rt5670_pr_cache_init(rt5670->regmap);
+	if (ret < 0) {
+		dev_err(&i2c->dev, "Failed to read PR registers: %d\n", ret);
+		return ret;
+	}
+
 	if (rt5670->pdata.in2_diff)
 		regmap_update_bits(rt5670->regmap, RT5670_IN2,
 					RT5670_IN_DF2, RT5670_IN_DF2);
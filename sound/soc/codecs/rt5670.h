@@ -14,6 +14,8 @@
 
 #include <sound/rt5670.h>
 
+#include "rt5670-dsp.h"
+
 /* Info */
 #define RT5670_RESET				0x00
 #define RT5670_VENDOR_ID			0xfd
@@ -79,6 +81,11 @@
 /* Private Register Control */
 #define RT5670_PRIV_INDEX			0x6a
 #define RT5670_PRIV_DATA			0x6c
+#define RT5670_PR_MAX				0xf8
+/* regmap window of the private registers */
+#define RT5670_PR_RANGE_BASE			(0xff + 1)
+#define RT5670_PR_SPACING			0x100
+#define RT5670_PR_BASE		(RT5670_PR_RANGE_BASE + (0 * RT5670_PR_SPACING))
 /* Format - ADC/DAC */
 #define RT5670_I2S4_SDP				0x6f
 #define RT5670_I2S1_SDP				0x70
@@ -1993,11 +2000,47 @@ struct rt5670_priv {
 	int pll_out;
 
 	int dsp_sw; /* expected parameter setting */
-	int dsp_rate;
+	int dsp_rate; /* RT5670_DSP_RATE_* of the DSP tables */
+	const char *dsp_fw_name;
+	struct rt5670_dsp_fw *dsp_fw;
+	spinlock_t dsp_fw_lock; /* dsp_fw swap vs. DSP regmap callbacks */
+	struct completion dsp_fw_done; /* firmware handled, DSP staged */
+	struct rt5670_dsp_fw_req *dsp_fw_req; /* valid until dsp_fw_done */
+	struct mutex dsp_mutex; /* DSP load state */
+	struct mutex dsp_cmd_lock; /* DSP command batch, inside dsp_mutex */
+	int dsp_cmd_err; /* first error of the current batch */
+	unsigned int dsp_clk; /* RT5670_DSP_CLK_* used for DSP commands */
+	u32 dsp_clk_errs[4]; /* failed DSP commands per clock */
+	unsigned int dsp_clk_max; /* fastest stable clock found by probing */
+	unsigned int dsp_clk_faults; /* failed DSP commands in a row */
+	bool dsp_clk_probed;
+	unsigned int dsp_holdoff_ms;
+	bool dsp_retained; /* idle DSP still holds dsp_cache_mode */
+	u8 *dsp_tuning; /* "DSP Tuning Block" section stream */
+	unsigned int dsp_tuning_len;
+	/* shadow of DSP memory, indexed by dsp_fw address slot */
+	u16 *dsp_shadow;
+	unsigned long *dsp_shadow_valid;
+	struct rt5670_dsp_busy_stats dsp_busy;
+	struct rt5670_dsp_stats dsp_stats;
+	struct rt5670_dsp_bench dsp_bench;
+	struct dentry *dsp_debugfs;
+	struct work_struct dsp_load_work; /* async DSP bring-up */
+	struct work_struct dsp_mode_work; /* live mode switch */
+	struct delayed_work dsp_park_work; /* park after the hold-off */
+	struct mutex dsp_mux_lock; /* dsp_mux_saved, dsp_mux_held */
+	unsigned int dsp_mux_saved; /* user setting of the DSP UL/DL muxes */
+	unsigned int dsp_mux_held; /* DSP UL/DL mux bits forced to bypass */
+	struct regmap *dsp_regmap; /* cache of DSP memory */
+	int dsp_cache_mode; /* table held by dsp_regmap, -1 if none */
+	bool dsp_regs_lost; /* PR/register records of it lost in suspend */
+	bool dsp_active; /* Voice DSP supply is on */
 	int jack_type;
 };
 
-int rt5670_write_fw(struct snd_soc_codec *codec, const struct firmware *fw,
-		    unsigned int pos, unsigned int num);
+int rt5670_write_fw(struct snd_soc_codec *codec,
+		    const struct rt5670_dsp_mode *tab);
+int rt5670_pr_write(struct regmap *regmap, unsigned int addr,
+		    const u16 *vals, unsigned int num);
 
 #endif /* __RT5670_H__ */